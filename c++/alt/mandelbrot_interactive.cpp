@@ -1,5 +1,10 @@
 #include <SFML/Graphics.hpp>
-#include <complex>
+
+#include "../mandelbrot_kernel.hpp"
+#include "../mandelbrot_palette.hpp"
+#include "../mandelbrot_viewport.hpp"
+#include "../pixel_buffer.hpp"
+#include "../tile_scheduler.hpp"
 
 #define USE_MUL_THREADS 1
 
@@ -9,13 +14,14 @@
 #include <chrono>
 #endif
 
-// g++ -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system && ./mandelbrot_interactive
+// g++ -O2 -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lgmpxx -lgmp && ./mandelbrot_interactive
 // If USE_MUL_THREADS is set:
-// g++ -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -pthread && ./mandelbrot_interactive
+// g++ -O2 -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lgmpxx -lgmp -pthread && ./mandelbrot_interactive
 
 const int WIDTH = 1280;
 const int HEIGHT = 800;
 const int MAX_ITERATIONS = 500;
+const int TILE_SIZE = 32;
 
 sf::Color getColor(int iterations) {
     int r, g, b;
@@ -30,46 +36,35 @@ sf::Color getColor(int iterations) {
     return sf::Color(r, g, b);
 }
 
-std::complex<float> convertToComplex(int x, int y, float zoom, std::complex<float> move) {
-    float real = (x - WIDTH / 2.0f) / (0.5f * zoom * WIDTH) + move.real();
-    float imag = (y - HEIGHT / 2.0f) / (0.5f * zoom * HEIGHT) + move.imag();
-    return std::complex<float>(real, imag);
-}
-
-int mandelbrot(std::complex<float> c) {
-    std::complex<float> z(0, 0);
-    int iter = 0;
-
-    while (abs(z) < 2 && iter < MAX_ITERATIONS) {
-        z = z * z + c;
-        iter++;
-    }
-
-    return iter;
-}
+// getColor() for every iteration count, looked up per pixel
+const Palette<sf::Color> palette(MAX_ITERATIONS, getColor);
 
-#if USE_MUL_THREADS
-void computeMandelbrotSection(sf::Image& image, float zoom, std::complex<float> move, int startY, int endY) {
-    for (int x = 0; x < WIDTH; x++) {
-        for (int y = startY; y < endY; y++) {
-            std::complex<float> c = convertToComplex(x, y, zoom, move);
-            int value = mandelbrot(c);
-            sf::Color color = getColor(value);
-            image.setPixel(x, y, color);
-        }
+// tile must be a tile of the pixel buffer's grid
+void computeMandelbrotSection(TiledPixelBuffer<sf::Color>& pixels, std::vector<int>& iterations, const ViewportRenderer& renderer, const Tile& tile) {
+    for (int y = tile.y0; y < tile.y1; y++) {
+        renderer.iterateRow(y, tile.x0, tile.x1, &iterations[y * WIDTH + tile.x0]);
     }
+    pixels.colorize(tile, iterations.data(), WIDTH, 1, palette);
 }
-#endif
 
 int main() {
     sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "Mandelbrot Set");
-    sf::Image image;
-    image.create(WIDTH, HEIGHT, sf::Color(0, 0, 0));
     sf::Texture texture;
-    sf::Sprite sprite;
+    texture.create(WIDTH, HEIGHT);
+    sf::Sprite sprite(texture);
+
+#if USE_MUL_THREADS
+    //TileScheduler scheduler(4, TILE_SIZE); // Number of threads to use
+    TileScheduler scheduler(std::thread::hardware_concurrency(), TILE_SIZE);
+#endif
+    ViewportRenderer renderer;
+
+    // Colored straight by the workers, one block per tile, and sent to the
+    // texture tile by tile
+    TiledPixelBuffer<sf::Color> pixels(WIDTH, HEIGHT, TILE_SIZE);
+    std::vector<int> iterations(WIDTH * HEIGHT);
 
-    float zoom = 1.0f;
-    std::complex<float> move(0, 0);
+    Viewport view(WIDTH, HEIGHT);
     bool redraw = true;
 
     while (window.isOpen()) {
@@ -80,26 +75,26 @@ int main() {
 
             // Handle zoom in and out
             if (event.type == sf::Event::MouseWheelMoved) {
-                if (event.mouseWheel.delta > 0) zoom *= 1.1f;
-                else zoom /= 1.1f;
+                if (event.mouseWheel.delta > 0) view.zoomBy(1.1);
+                else view.zoomBy(1 / 1.1);
                 redraw = true;
             }
 
             // Handle pan
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left)) {
-                move -= std::complex<float>(0.1f / zoom, 0);
+                view.pan(-0.1 / view.zoom, 0);
                 redraw = true;
             }
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right)) {
-                move += std::complex<float>(0.1f / zoom, 0);
+                view.pan(0.1 / view.zoom, 0);
                 redraw = true;
             }
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up)) {
-                move -= std::complex<float>(0, 0.1f / zoom);
+                view.pan(0, -0.1 / view.zoom);
                 redraw = true;
             }
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down)) {
-                move += std::complex<float>(0, 0.1f / zoom);
+                view.pan(0, 0.1 / view.zoom);
                 redraw = true;
             }
 
@@ -110,34 +105,21 @@ int main() {
         }
 
         if (redraw) {
+            renderer.beginFrame(view, MAX_ITERATIONS);
 #if USE_MUL_THREADS
-        //const int threadCount = 4; // Number of threads to use
-        unsigned int threadCount = std::thread::hardware_concurrency();
-        std::vector<std::thread> threads;
-
-        // Divide the work among threads
-        for (int i = 0; i < threadCount; ++i) {
-            int startY = i * HEIGHT / threadCount;
-            int endY = (i + 1) * HEIGHT / threadCount;
-            threads.emplace_back(computeMandelbrotSection, std::ref(image), zoom, move, startY, endY);
-        }
-
-        // Join threads
-        for (auto& t : threads) {
-            t.join();
-        }
+            scheduler.run(WIDTH, HEIGHT, [&](const Tile& tile) {
+                computeMandelbrotSection(pixels, iterations, renderer, tile);
+            });
 #else
-            for (int x = 0; x < WIDTH; x++) {
-                for (int y = 0; y < HEIGHT; y++) {
-                    std::complex<float> c = convertToComplex(x, y, zoom, move);
-                    int value = mandelbrot(c);
-                    sf::Color color = getColor(value);
-                    image.setPixel(x, y, color);
+            for (int y = 0; y < HEIGHT; y += TILE_SIZE) {
+                for (int x = 0; x < WIDTH; x += TILE_SIZE) {
+                    computeMandelbrotSection(pixels, iterations, renderer, {x, y, std::min(x + TILE_SIZE, WIDTH), std::min(y + TILE_SIZE, HEIGHT)});
                 }
             }
 #endif
-            texture.loadFromImage(image);
-            sprite.setTexture(texture);
+            pixels.flush([&](const sf::Color* tile, int width, int height, int x, int y) {
+                texture.update(reinterpret_cast<const sf::Uint8*>(tile), width, height, x, y);
+            });
             redraw = false;
         }
 
@@ -149,6 +131,10 @@ int main() {
         window.display();
     }
 
+    std::vector<sf::Color> saved(WIDTH * HEIGHT);
+    pixels.copyTo(saved.data());
+    sf::Image image;
+    image.create(WIDTH, HEIGHT, reinterpret_cast<const sf::Uint8*>(saved.data()));
     image.saveToFile("mandelbrot_interactive.png");
 
     return 0;
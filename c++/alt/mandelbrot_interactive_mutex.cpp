@@ -1,55 +1,40 @@
 #include <SFML/Graphics.hpp>
-#include <complex>
-#include <thread>
+#include <iostream>
 #include <vector>
-#include <chrono>
-#include <mutex>
-#include <condition_variable>
 
-// g++ -o mandelbrot_interactive_mutex mandelbrot_interactive_mutex.cpp -lsfml-graphics -lsfml-window -lsfml-system -pthread && ./mandelbrot_interactive_mutex
+#include "../mandelbrot_palette.hpp"
+#include "../mandelbrot_viewport.hpp"
+#include "../render_engine.hpp"
+
+// g++ -O2 -o mandelbrot_interactive_mutex mandelbrot_interactive_mutex.cpp -lsfml-graphics -lsfml-window -lsfml-system -lgmpxx -lgmp -pthread && ./mandelbrot_interactive_mutex
 
 /**
 The drawing logic for this code works in the following way:
 
-Detecting an Update Request:
-When an event occurs (such as zooming or panning), the handleEvent function in
-the main loop sets updateRequested to true and notifies the condition variable
-cv. The redrawThreadFunction wakes up upon this notification.
-
-Setting the Last Update Time:
-As soon as the redrawThreadFunction wakes up, it records the current time as
-lastUpdate. This timestamp represents the moment of the last update request.
-
-Waiting for 500 ms or a New Event:
-The thread then enters a loop where it waits until either:
-500ms has passed since lastUpdate (using cv.wait_until).
-A new update request arrives (if updateRequested becomes true again).
-If a new event occurs before 500 ms has passed, the handleEvent function sets
-updateRequested to true again, and the condition variable cv is notified. This
-causes the thread to reset the lastUpdate time and start the 1-second wait
-again.
-
-Redrawing After 500 ms of No New Events:
-If no new event occurs within the 1-second window, the thread proceeds to
-execute the redraw logic, updating the Mandelbrot set with the latest zoom and
-pan settings. After redrawing, the thread goes back to waiting for the next
-event.
-
-By resetting the lastUpdate time with every new event and using cv.wait_until,
-the thread effectively delays the redraw until there are no new events for 500
-ms. This approach avoids the issue of the program being unresponsive or sluggish
-due to frequent and rapid redrawing when multiple events occur in quick
-succession.
+Publishing the View:
+The UI thread owns view. When an event changes it (zooming or panning),
+handleEvent returns true and the main loop hands a copy to the RenderEngine
+with request(). The engine keeps that copy as an immutable snapshot, so the
+two threads never share a Viewport, a texture or a sprite.
+
+Rendering in the Background:
+The engine thread renders the latest snapshot in passes of every 4th, every
+2nd and finally every pixel. The workers color each tile into the back
+buffer as they finish it, and the finished pass is swapped atomically with
+the buffer waiting for the UI. A new request cancels the running pass at the
+next row, so a frame that is out of date is never finished.
+
+Showing Finished Frames:
+On every turn of the main loop acquire() checks, without waiting, whether a
+pass was finished since the last turn. Only then is the texture updated, with
+the tiles of the front buffer that changed, which the engine does not touch
+until it is handed back. The window is redrawn at display rate however long a frame takes.
 */
 
 const int WIDTH = 1280;
 const int HEIGHT = 800;
 const int MAX_ITERATIONS = 500;
-
-bool updateRequested = true;
-bool redrawPending = false;
-std::mutex mtx;
-std::condition_variable cv;
+const int TILE_SIZE = 32;
 
 sf::Color getColor(int iterations) {
     int r, g, b;
@@ -64,111 +49,52 @@ sf::Color getColor(int iterations) {
     return sf::Color(r, g, b);
 }
 
-std::complex<float> convertToComplex(int x, int y, float zoom, std::complex<float> move) {
-    float real = (x - WIDTH / 2.0f) / (0.5f * zoom * WIDTH) + move.real();
-    float imag = (y - HEIGHT / 2.0f) / (0.5f * zoom * HEIGHT) + move.imag();
-    return std::complex<float>(real, imag);
-}
-
-int mandelbrot(std::complex<float> c) {
-    std::complex<float> z(0, 0);
-    int iter = 0;
-
-    while (abs(z) < 2 && iter < MAX_ITERATIONS) {
-        z = z * z + c;
-        iter++;
-    }
-
-    return iter;
-}
+// getColor() for every iteration count, looked up per pixel
+const Palette<sf::Color> palette(MAX_ITERATIONS, getColor);
 
-void computeMandelbrotSection(sf::Image& image, float zoom, std::complex<float> move, int startY, int endY) {
-    for (int x = 0; x < WIDTH; x++) {
-        for (int y = startY; y < endY; y++) {
-            std::complex<float> c = convertToComplex(x, y, zoom, move);
-            int value = mandelbrot(c);
-            sf::Color color = getColor(value);
-            image.setPixel(x, y, color);
-        }
-    }
-}
-
-bool handleEvent(const sf::Event& event, float& zoom, std::complex<float>& move) {
+bool handleEvent(const sf::Event& event, Viewport& view) {
     bool updateRequested = false;
 
     if (event.type == sf::Event::MouseWheelMoved) {
-        if (event.mouseWheel.delta > 0) zoom *= 1.1f;
-        else zoom /= 1.1f;
+        if (event.mouseWheel.delta > 0) view.zoomBy(1.1);
+        else view.zoomBy(1 / 1.1);
         updateRequested = true;
     }
 
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left)) {
-        move -= std::complex<float>(0.1f / zoom, 0);
+        view.pan(-0.1 / view.zoom, 0);
         updateRequested = true;
     }
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right)) {
-        move += std::complex<float>(0.1f / zoom, 0);
+        view.pan(0.1 / view.zoom, 0);
         updateRequested = true;
     }
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up)) {
-        move -= std::complex<float>(0, 0.1f / zoom);
+        view.pan(0, -0.1 / view.zoom);
         updateRequested = true;
     }
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down)) {
-        move += std::complex<float>(0, 0.1f / zoom);
+        view.pan(0, 0.1 / view.zoom);
         updateRequested = true;
     }
 
     return updateRequested;
 }
 
-void redrawThreadFunction(sf::Image& image, sf::Texture& texture, sf::Sprite& sprite, sf::RenderWindow& window, float& zoom, std::complex<float>& move) {
-    std::chrono::steady_clock::time_point lastUpdate = std::chrono::steady_clock::now();
-
-    while (window.isOpen()) {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, [&]() { return updateRequested; });
-
-        // Update the time of the last update request
-        lastUpdate = std::chrono::steady_clock::now();
-        updateRequested = false;
-
-        while (std::chrono::steady_clock::now() < lastUpdate + std::chrono::seconds(1)) {
-            //cv.wait_until(lock, lastUpdate + std::chrono::seconds(1));
-            cv.wait_until(lock, lastUpdate + std::chrono::milliseconds(500));
-        }
-
-        if (window.isOpen() && !updateRequested) {
-            // Redraw logic
-            //const int threadCount = 4; // Number of threads to use
-            unsigned int threadCount = std::thread::hardware_concurrency();
-            std::vector<std::thread> threads;
-            for (int i = 0; i < threadCount; ++i) {
-                int startY = i * HEIGHT / threadCount;
-                int endY = (i + 1) * HEIGHT / threadCount;
-                threads.emplace_back(computeMandelbrotSection, std::ref(image), zoom, move, startY, endY);
-            }
-            for (auto& t : threads) {
-                t.join();
-            }
-
-            texture.loadFromImage(image);
-            sprite.setTexture(texture);
-        }
-    }
-}
-
 int main() {
     sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "Mandelbrot Set");
-    sf::Image image;
-    image.create(WIDTH, HEIGHT, sf::Color(0, 0, 0));
+    window.setVerticalSyncEnabled(true);
     sf::Texture texture;
-    sf::Sprite sprite;
+    texture.create(WIDTH, HEIGHT);
+    sf::Sprite sprite(texture);
 
-    float zoom = 1.0f;
-    std::complex<float> move(0, 0);
+    EngineOptions options;
+    //options.threads = 4; // Number of threads to use
+    options.tileSize = TILE_SIZE;
+    RenderEngine<sf::Color> engine(WIDTH, HEIGHT, MAX_ITERATIONS, palette, options);
 
-    std::thread redrawThread(redrawThreadFunction, std::ref(image), std::ref(texture), std::ref(sprite), std::ref(window), std::ref(zoom), std::ref(move));
+    Viewport view(WIDTH, HEIGHT);
+    engine.request(view);
 
     while (window.isOpen()) {
         sf::Event event;
@@ -181,11 +107,17 @@ int main() {
                 window.close();
             }
 
-            if (handleEvent(event, zoom, move)) {
-                std::lock_guard<std::mutex> lock(mtx);
-                redrawPending = true;
-                updateRequested = true;
-                cv.notify_one();
+            if (handleEvent(event, view)) {
+                engine.request(view);
+            }
+        }
+
+        if (engine.acquire()) {
+            engine.upload([&](const sf::Color* tile, int width, int height, int x, int y) {
+                texture.update(reinterpret_cast<const sf::Uint8*>(tile), width, height, x, y);
+            });
+            if (engine.getInfo().complete) {
+                std::cout << "Using " << engine.getThreadCount() << " threads, " << engine.getInfo().renderMs << " ms" << std::endl;
             }
         }
 
@@ -194,7 +126,11 @@ int main() {
         window.display();
     }
 
-    redrawThread.join();
+    // The last frame shown, whether or not the engine got further
+    std::vector<sf::Color> saved(WIDTH * HEIGHT);
+    engine.getPixels().copyTo(saved.data());
+    sf::Image image;
+    image.create(WIDTH, HEIGHT, reinterpret_cast<const sf::Uint8*>(saved.data()));
     image.saveToFile("mandelbrot_interactive_mutex.png");
 
     return 0;
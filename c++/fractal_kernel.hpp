@@ -0,0 +1,379 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "mandelbrot_kernel.hpp"
+
+// Escape-time kernels for the Mandelbrot family, specialized at compile time.
+//
+// One template covers z -> z^power + c for the Mandelbrot set (z starts at 0,
+// c is the pixel) and Julia sets (z starts at the pixel, c is fixed), with
+// the escape radius and the bailout test (|z| < R, or the cheaper
+// max(|re|, |im|) < R) as template parameters too. Each instantiation has its
+// power multiplied out and its constants folded, so a variant costs nothing
+// in the loop for being configurable.
+//
+// The SIMD versions are the same template on GCC vector types, compiled once
+// per ISA, so every variant gets all the lanes of the CPU without its own
+// intrinsics. They may use FMA where the ISA has it, so counts near the
+// boundary can differ between ISAs by a little.
+//
+// A dispatch table instantiates the common combinations (FractalPowers x
+// Mandelbrot / Julia x bailout x FractalRadii); selectFractalRow() looks a
+// spec up at runtime. Adding a combination is a matter of extending those
+// lists. The classic z^2 + c with radius 2 keeps the hand-written kernels of
+// mandelbrot_kernel.hpp.
+
+enum class Bailout { Circle, Square };
+
+struct FractalSpec {
+    int power = 2;
+    bool julia = false;
+    double juliaReal = -0.8; // c of the Julia set
+    double juliaImag = 0.156;
+    int escapeRadius = 2;
+    Bailout bailout = Bailout::Circle;
+
+    bool isClassic() const { return power == 2 && !julia && escapeRadius == 2 && bailout == Bailout::Circle; }
+
+    // The cardioid / bulb test only holds for the degree 2 Mandelbrot set
+    bool hasInteriorTest() const { return power == 2 && !julia; }
+
+    std::string name() const {
+        std::string text = (julia ? "julia" : power == 2 ? "mandelbrot" : "multibrot") + std::string(" z^") + std::to_string(power);
+        if (julia)
+            text += " c=" + std::to_string(juliaReal) + (juliaImag < 0 ? "" : "+") + std::to_string(juliaImag) + "i";
+        text += " R=" + std::to_string(escapeRadius) + (bailout == Bailout::Square ? " square" : "");
+        return text;
+    }
+};
+
+using FractalPowers = std::integer_sequence<int, 2, 3, 4, 5>;
+using FractalRadii = std::integer_sequence<int, 2, 16>;
+
+// Like MandelbrotRowFn, plus the c of Julia sets (ignored for the Mandelbrot
+// set)
+template <typename T>
+using FractalRowFn = void (*)(const T* real, const T* imag, int imagStride, int count, int maxIterations, T juliaReal, T juliaImag, bool periodicity,
+                              int* iterations);
+
+// z = z^Power, multiplied out by squaring; works on scalars and vectors
+template <int Power, typename V>
+inline void complexPower(V& re, V& im) {
+    static_assert(Power >= 1, "power must be positive");
+    if constexpr (Power % 2 == 0) {
+        complexPower<Power / 2>(re, im);
+        V r = re * re - im * im;
+        V ri = re * im;
+        im = ri + ri;
+        re = r;
+    } else if constexpr (Power > 1) {
+        V r0 = re, i0 = im;
+        complexPower<Power - 1>(re, im);
+        V r = re * r0 - im * i0;
+        im = re * i0 + im * r0;
+        re = r;
+    }
+}
+
+// Clears active (a bool for scalars, a lane mask for vectors) where z has
+// escaped
+template <typename S, Bailout B, int Radius, typename V, typename Mask>
+inline void maskEscaped(const V& re, const V& im, Mask& active) {
+    const S r2 = S(double(Radius) * Radius);
+    if constexpr (B == Bailout::Circle)
+        active &= re * re + im * im < r2;
+    else {
+        // max(re^2, im^2) < r2 as a single compare, see fractalRowLanes
+        V re2 = re * re, im2 = im * im;
+        active &= (re2 < im2 ? im2 : re2) < r2;
+    }
+}
+
+template <typename T, int Power, bool Julia, Bailout B, int Radius>
+inline int fractalPoint(T x, T y, T juliaReal, T juliaImag, int maxIterations, bool periodicity) {
+    T zr = Julia ? x : T(0), zi = Julia ? y : T(0);
+    T cr = Julia ? juliaReal : x, ci = Julia ? juliaImag : y;
+    T savedR = zr, savedI = zi;
+    int checkpoint = 1, sinceCheckpoint = 0;
+    int iter = 0;
+
+    while (iter < maxIterations) {
+        bool active = true;
+        maskEscaped<T, B, Radius>(zr, zi, active);
+        if (!active)
+            break;
+        complexPower<Power>(zr, zi);
+        zr = zr + cr;
+        zi = zi + ci;
+        iter++;
+
+        if (periodicity) {
+            if (zr == savedR && zi == savedI)
+                return maxIterations;
+            if (++sinceCheckpoint == checkpoint) {
+                savedR = zr;
+                savedI = zi;
+                sinceCheckpoint = 0;
+                checkpoint *= 2;
+            }
+        }
+    }
+    return iter;
+}
+
+template <typename T, int Power, bool Julia, Bailout B, int Radius>
+inline void fractalRowScalar(const T* real, const T* imag, int imagStride, int count, int maxIterations, T juliaReal, T juliaImag, bool periodicity,
+                             int* iterations) {
+    for (int i = 0; i < count; i++) {
+        iterations[i] = fractalPoint<T, Power, Julia, B, Radius>(real[i], imag[i * imagStride], juliaReal, juliaImag, maxIterations, periodicity);
+    }
+}
+
+#if KERNEL_X86
+
+template <typename T, int Lanes>
+struct SimdVector {
+    typedef T type __attribute__((vector_size(sizeof(T) * Lanes)));
+};
+
+// OR of the 64-bit words of a mask, which compiles to a vector test
+template <typename Mask>
+__attribute__((always_inline)) inline bool anyLane(const Mask& mask) {
+    unsigned long long words[sizeof(Mask) / 8];
+    std::memcpy(words, &mask, sizeof(Mask));
+    unsigned long long any = 0;
+    for (size_t w = 0; w < sizeof(Mask) / 8; w++) {
+        any |= words[w];
+    }
+    return any != 0;
+}
+
+// Lanes pixels at a time; escaped lanes are masked out like in the
+// hand-written kernels. Only inlined into the per-ISA functions below.
+template <typename T, int Power, bool Julia, Bailout B, int Radius, int Lanes>
+__attribute__((always_inline)) inline void fractalRowLanes(const T* real, const T* imag, int imagStride, int count, int maxIterations, T juliaReal,
+                                                           T juliaImag, bool periodicity, int* iterations) {
+    using V = typename SimdVector<T, Lanes>::type;
+    using Mask = decltype(V{} < V{});
+
+    for (int i = 0; i < count; i += Lanes) {
+        int lanes = std::min(Lanes, count - i);
+        V x = {}, y = {};
+        Mask active = {};
+        for (int l = 0; l < lanes; l++) {
+            x[l] = real[i + l];
+            y[l] = imag[(i + l) * imagStride];
+            active[l] = -1;
+        }
+
+        V zr = {}, zi = {}, cr = x, ci = y;
+        if constexpr (Julia) {
+            zr = x;
+            zi = y;
+            cr = V{} + juliaReal;
+            ci = V{} + juliaImag;
+        }
+        V savedR = zr, savedI = zi;
+        Mask iter = {}, cycled = {};
+        int checkpoint = 1, sinceCheckpoint = 0;
+
+        for (int n = 0; n < maxIterations; n++) {
+            maskEscaped<T, B, Radius>(zr, zi, active);
+            if (!anyLane(active))
+                break;
+
+            complexPower<Power>(zr, zi);
+            zr = zr + cr;
+            zi = zi + ci;
+            // Active lanes are all ones (-1), so subtracting counts them
+            iter -= active;
+
+            if (periodicity) {
+                // One compare on the bit patterns: GCC scalarizes the & of
+                // two float compares on 512-bit vectors
+                Mask moved = ((Mask)zr ^ (Mask)savedR) | ((Mask)zi ^ (Mask)savedI);
+                Mask stillActive = active;
+                stillActive &= moved != 0;
+                cycled |= active & ~stillActive;
+                active = stillActive;
+                if (++sinceCheckpoint == checkpoint) {
+                    savedR = zr;
+                    savedI = zi;
+                    sinceCheckpoint = 0;
+                    checkpoint *= 2;
+                }
+            }
+        }
+
+        for (int l = 0; l < lanes; l++) {
+            iterations[i + l] = cycled[l] ? maxIterations : static_cast<int>(iter[l]);
+        }
+    }
+}
+
+template <typename T, int Power, bool Julia, Bailout B, int Radius>
+__attribute__((target("avx2"))) inline void fractalRowAvx2(const T* real, const T* imag, int imagStride, int count, int maxIterations, T juliaReal,
+                                                           T juliaImag, bool periodicity, int* iterations) {
+    fractalRowLanes<T, Power, Julia, B, Radius, 32 / sizeof(T)>(real, imag, imagStride, count, maxIterations, juliaReal, juliaImag, periodicity, iterations);
+}
+
+template <typename T, int Power, bool Julia, Bailout B, int Radius>
+__attribute__((target("avx512f"))) inline void fractalRowAvx512(const T* real, const T* imag, int imagStride, int count, int maxIterations, T juliaReal,
+                                                                T juliaImag, bool periodicity, int* iterations) {
+    fractalRowLanes<T, Power, Julia, B, Radius, 64 / sizeof(T)>(real, imag, imagStride, count, maxIterations, juliaReal, juliaImag, periodicity, iterations);
+}
+
+#endif
+
+template <typename T, int Power, bool Julia, Bailout B, int Radius>
+inline FractalRowFn<T> fractalRowFor(KernelIsa isa) {
+#if KERNEL_X86
+    if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
+        if (isa == KernelIsa::Avx512)
+            return fractalRowAvx512<T, Power, Julia, B, Radius>;
+        if (isa == KernelIsa::Avx2)
+            return fractalRowAvx2<T, Power, Julia, B, Radius>;
+    }
+#else
+    (void)isa;
+#endif
+    return fractalRowScalar<T, Power, Julia, B, Radius>;
+}
+
+template <typename T>
+struct FractalTableEntry {
+    int power;
+    bool julia;
+    Bailout bailout;
+    int escapeRadius;
+    FractalRowFn<T> rowFn;
+};
+
+template <typename T, int Power, bool Julia, Bailout B, int... Radii>
+inline void addFractalRadii(std::vector<FractalTableEntry<T>>& table, KernelIsa isa, std::integer_sequence<int, Radii...>) {
+    (table.push_back({Power, Julia, B, Radii, fractalRowFor<T, Power, Julia, B, Radii>(isa)}), ...);
+}
+
+template <typename T, int... Powers>
+inline void addFractalPowers(std::vector<FractalTableEntry<T>>& table, KernelIsa isa, std::integer_sequence<int, Powers...>) {
+    (addFractalRadii<T, Powers, false, Bailout::Circle>(table, isa, FractalRadii{}), ...);
+    (addFractalRadii<T, Powers, false, Bailout::Square>(table, isa, FractalRadii{}), ...);
+    (addFractalRadii<T, Powers, true, Bailout::Circle>(table, isa, FractalRadii{}), ...);
+    (addFractalRadii<T, Powers, true, Bailout::Square>(table, isa, FractalRadii{}), ...);
+}
+
+// All instantiated row functions for one ISA
+template <typename T>
+inline std::vector<FractalTableEntry<T>> makeFractalTable(KernelIsa isa) {
+    std::vector<FractalTableEntry<T>> table;
+    addFractalPowers<T>(table, isa, FractalPowers{});
+    return table;
+}
+
+// The generic row function for spec, or nullptr if that combination is not
+// instantiated. The ISA falls back like selectMandelbrotRow().
+template <typename T>
+inline FractalRowFn<T> selectFractalRow(const FractalSpec& spec, KernelIsa isa = KernelIsa::Auto) {
+    KernelIsa supported = detectKernelIsa();
+    if (isa == KernelIsa::Auto || static_cast<int>(isa) > static_cast<int>(supported))
+        isa = supported;
+
+    for (const FractalTableEntry<T>& entry : makeFractalTable<T>(isa)) {
+        if (entry.power == spec.power && entry.julia == spec.julia && entry.bailout == spec.bailout && entry.escapeRadius == spec.escapeRadius)
+            return entry.rowFn;
+    }
+    return nullptr;
+}
+
+// Iterates rows or runs of points of one fractal, the counterpart of
+// mandelbrotRow() / mandelbrotPoints(). The classic Mandelbrot set goes to the
+// hand-written kernels; everything else to the dispatch table.
+template <typename T>
+class FractalKernel {
+public:
+    explicit FractalKernel(const FractalSpec& spec = FractalSpec(), KernelIsa isa = KernelIsa::Auto, const KernelOptions& options = kernelOptions)
+        : spec(spec), options(options), juliaReal(static_cast<T>(spec.juliaReal)), juliaImag(static_cast<T>(spec.juliaImag)) {
+        if (spec.isClassic())
+            classicFn = selectMandelbrotRow<T>(isa);
+        else
+            rowFn = selectFractalRow<T>(spec, isa);
+    }
+
+    // False if the spec is not in the dispatch table
+    bool isValid() const { return classicFn || rowFn; }
+
+    const FractalSpec& getSpec() const { return spec; }
+
+    // Moves a Julia kernel to another c without looking its row function up again
+    void setJuliaC(double real, double imag) {
+        spec.juliaReal = real;
+        spec.juliaImag = imag;
+        juliaReal = static_cast<T>(real);
+        juliaImag = static_cast<T>(imag);
+    }
+
+    void iterateRow(const T* real, T imag, int count, int maxIterations, int* iterations) const {
+        if (classicFn)
+            mandelbrotRow(classicFn, real, imag, count, maxIterations, iterations, options);
+        else
+            iterate(real, &imag, 0, count, maxIterations, iterations);
+    }
+
+    void iteratePoints(const T* real, const T* imag, int count, int maxIterations, int* iterations) const {
+        if (classicFn)
+            mandelbrotPoints(classicFn, real, imag, count, maxIterations, iterations, options);
+        else
+            iterate(real, imag, 1, count, maxIterations, iterations);
+    }
+
+private:
+    FractalSpec spec;
+    KernelOptions options;
+    T juliaReal;
+    T juliaImag;
+    MandelbrotRowFn<T> classicFn = nullptr;
+    FractalRowFn<T> rowFn = nullptr;
+
+    // Pixels inside the cardioid or bulb are filled in directly where that
+    // test applies, and the rest packed together as in mandelbrotPoints()
+    void iterate(const T* real, const T* imag, int imagStride, int count, int maxIterations, int* iterations) const {
+        if (count == 0)
+            return;
+        if (!options.interiorCheck || !spec.hasInteriorTest()) {
+            rowFn(real, imag, imagStride, count, maxIterations, juliaReal, juliaImag, options.periodicityCheck, iterations);
+            return;
+        }
+
+        thread_local std::vector<T> outsideReal;
+        thread_local std::vector<T> outsideImag;
+        thread_local std::vector<int> outsideIndex;
+        thread_local std::vector<int> outsideIterations;
+        outsideReal.clear();
+        outsideImag.clear();
+        outsideIndex.clear();
+
+        for (int i = 0; i < count; i++) {
+            if (inCardioidOrBulb(real[i], imag[i * imagStride])) {
+                iterations[i] = maxIterations;
+            } else {
+                outsideReal.push_back(real[i]);
+                outsideImag.push_back(imag[i * imagStride]);
+                outsideIndex.push_back(i);
+            }
+        }
+
+        int outside = static_cast<int>(outsideIndex.size());
+        outsideIterations.resize(outside);
+        if (outside > 0)
+            rowFn(outsideReal.data(), outsideImag.data(), 1, outside, maxIterations, juliaReal, juliaImag, options.periodicityCheck, outsideIterations.data());
+        for (int i = 0; i < outside; i++) {
+            iterations[outsideIndex[i]] = outsideIterations[i];
+        }
+    }
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tile_scheduler.hpp"
+
+// Per-frame timing of the interactive loop.
+//
+// A frame is everything between two updates of the picture on screen, which
+// usually spans many turns of the main loop. The main thread times its phases
+// with scope(), and phases done for it on another thread (coloring on a
+// render engine) are added with addPhase(); whatever is left is waiting for
+// the workers (idle turns of the loop, or a blocking scheduler run). Worker time comes
+// from the WorkerStats of the passes finished during the frame, so the kernel
+// is measured per worker and not as main thread time.
+//
+// Finished frames are kept for the overlay and, when file names are given,
+// appended to a CSV file and to a Chrome trace (chrome://tracing or
+// ui.perfetto.dev) as they happen.
+
+enum class FramePhase { Events, Color, Upload, Present, Count };
+
+inline const char* framePhaseName(FramePhase phase) {
+    switch (phase) {
+    case FramePhase::Events: return "events";
+    case FramePhase::Color: return "color";
+    case FramePhase::Upload: return "upload";
+    case FramePhase::Present: return "present";
+    default: return "?";
+    }
+}
+
+struct FrameRecord {
+    int index = 0;
+    double startMs = 0;
+    double totalMs = 0;
+    double phaseMs[static_cast<int>(FramePhase::Count)] = {};
+    double waitMs = 0;
+
+    double kernelMs = 0;              // Wall time of the passes finished in the frame
+    std::vector<double> workerBusyMs; // Per worker, summed over those passes
+
+    long long iterations = 0; // Sum of the counts shown; -1 if not counted
+    long long pixels = 0;
+    long long maxIterationPixels = 0;
+
+    double phase(FramePhase p) const { return phaseMs[static_cast<int>(p)]; }
+    double maxIterationShare() const { return pixels > 0 ? static_cast<double>(maxIterationPixels) / pixels : 0; }
+};
+
+class FrameProfiler {
+public:
+    // Empty file names turn the corresponding output off
+    explicit FrameProfiler(const std::string& csvFile = "", const std::string& traceFile = "", size_t historySize = 120)
+        : historySize(historySize), origin(Clock::now()) {
+        if (!csvFile.empty()) {
+            csv.open(csvFile, std::ios::trunc);
+            if (!csv)
+                std::cerr << "Could not open " << csvFile << " for writing." << std::endl;
+            csv.setf(std::ios::fixed);
+            csv.precision(3);
+        }
+        if (!traceFile.empty()) {
+            trace.open(traceFile, std::ios::trunc);
+            if (!trace)
+                std::cerr << "Could not open " << traceFile << " for writing." << std::endl;
+            else
+                trace << "[\n";
+        }
+        current.iterations = -1;
+    }
+
+    ~FrameProfiler() {
+        if (trace.is_open())
+            trace << "\n]\n";
+    }
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    // Times a main thread phase until the end of the scope
+    class Scope {
+    public:
+        Scope(FrameProfiler& profiler, FramePhase phase) : profiler(profiler), phase(phase), start(profiler.nowMs()) {}
+        ~Scope() { stop(); }
+
+        // Ends the phase before the end of the scope
+        void stop() {
+            if (stopped)
+                return;
+            profiler.addPhase(phase, start, profiler.nowMs() - start);
+            stopped = true;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        FrameProfiler& profiler;
+        FramePhase phase;
+        double start;
+        bool stopped = false;
+    };
+
+    Scope scope(FramePhase phase) { return Scope(*this, phase); }
+
+    void addPhase(FramePhase phase, double startMs, double ms) {
+        current.phaseMs[static_cast<int>(phase)] += ms;
+        // Only noticeable spans go to the trace; idle turns of the loop would
+        // bury everything else
+        if (trace.is_open() && ms >= MIN_TRACE_MS)
+            spans.push_back({framePhaseName(phase), startMs, ms});
+    }
+
+    // A phase of ms done on another thread and just collected
+    void addPhase(FramePhase phase, double ms) { addPhase(phase, nowMs() - ms, ms); }
+
+    // Call right after the pass that produced stats was collected
+    void addWorkers(const std::vector<WorkerStats>& stats) {
+        if (stats.empty())
+            return;
+        double wallMs = stats[0].busyMs + stats[0].idleMs;
+        current.kernelMs += wallMs;
+        current.workerBusyMs.resize(std::max(current.workerBusyMs.size(), stats.size()), 0.0);
+        for (size_t i = 0; i < stats.size(); i++) {
+            current.workerBusyMs[i] += stats[i].busyMs;
+        }
+
+        if (trace.is_open()) {
+            double start = nowMs() - wallMs;
+            for (size_t i = 0; i < stats.size(); i++) {
+                std::ostringstream event;
+                event.setf(std::ios::fixed);
+                event << "{\"name\": \"kernel\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << i + 1 << ", \"ts\": " << start * 1000.0
+                      << ", \"dur\": " << stats[i].busyMs * 1000.0 << ", \"args\": {\"tiles\": " << stats[i].tiles << ", \"stolen\": " << stats[i].stolen
+                      << ", \"idle_ms\": " << stats[i].idleMs << "}}";
+                writeTraceEvent(event.str());
+            }
+        }
+    }
+
+    // Iteration counts of the pixels shown, summed where they were colored
+    void addIterationTotals(long long iterations, long long pixels, long long maxIterationPixels) {
+        if (current.iterations < 0)
+            current.iterations = 0;
+        current.iterations += iterations;
+        current.pixels += pixels;
+        current.maxIterationPixels += maxIterationPixels;
+    }
+
+    // Ends the frame if the picture on screen changed; otherwise the time of
+    // this turn of the loop carries over into the next frame
+    void endFrame(bool shown) {
+        if (!shown)
+            return;
+
+        double now = nowMs();
+        current.index = frameIndex++;
+        current.startMs = frameStartMs;
+        current.totalMs = now - frameStartMs;
+        double mainMs = 0;
+        for (double ms : current.phaseMs) {
+            mainMs += ms;
+        }
+        current.waitMs = std::max(0.0, current.totalMs - mainMs);
+
+        writeCsv(current);
+        writeTrace(current);
+
+        history.push_back(std::move(current));
+        if (history.size() > historySize)
+            history.pop_front();
+
+        current = FrameRecord();
+        current.iterations = -1;
+        spans.clear();
+        frameStartMs = now;
+    }
+
+    const std::deque<FrameRecord>& getHistory() const { return history; }
+
+    // Text for the overlay: the last frame and the average over the history
+    std::string summary() const {
+        std::ostringstream out;
+        out.setf(std::ios::fixed);
+        out.precision(1);
+        if (history.empty()) {
+            out << "no frames yet";
+            return out.str();
+        }
+
+        const FrameRecord& last = history.back();
+        out << "frame " << last.index << ": " << last.totalMs << " ms\n";
+        for (int p = 0; p < static_cast<int>(FramePhase::Count); p++) {
+            out << "  " << framePhaseName(static_cast<FramePhase>(p)) << " " << last.phaseMs[p] << " ms\n";
+        }
+        out << "  wait " << last.waitMs << " ms\n";
+        out << "  kernel " << last.kernelMs << " ms on " << last.workerBusyMs.size() << " workers";
+        if (!last.workerBusyMs.empty()) {
+            auto range = std::minmax_element(last.workerBusyMs.begin(), last.workerBusyMs.end());
+            out << " (busy " << *range.first << " - " << *range.second << " ms)";
+        }
+        out << "\n";
+        if (last.iterations >= 0) {
+            out << "  " << last.iterations / 1e6 << " M iterations, " << last.maxIterationShare() * 100.0 << "% at max\n";
+        }
+
+        double total = 0;
+        for (const FrameRecord& frame : history) {
+            total += frame.totalMs;
+        }
+        out << "average of " << history.size() << ": " << total / history.size() << " ms";
+        return out.str();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Span {
+        const char* name;
+        double startMs;
+        double ms;
+    };
+
+    static constexpr double MIN_TRACE_MS = 0.1;
+
+    size_t historySize;
+    Clock::time_point origin;
+    double frameStartMs = 0;
+    int frameIndex = 0;
+
+    FrameRecord current;
+    std::vector<Span> spans;
+    std::deque<FrameRecord> history;
+
+    std::ofstream csv;
+    bool csvHeader = false;
+    std::ofstream trace;
+    bool firstTraceEvent = true;
+
+    double nowMs() const { return std::chrono::duration<double, std::milli>(Clock::now() - origin).count(); }
+
+    void writeCsv(const FrameRecord& frame) {
+        if (!csv.is_open())
+            return;
+        if (!csvHeader) {
+            csv << "frame,start_ms,total_ms";
+            for (int p = 0; p < static_cast<int>(FramePhase::Count); p++) {
+                csv << "," << framePhaseName(static_cast<FramePhase>(p)) << "_ms";
+            }
+            csv << ",wait_ms,kernel_ms,worker_busy_max_ms,worker_busy_mean_ms,iterations,max_iteration_share" << std::endl;
+            csvHeader = true;
+        }
+
+        double busyMax = 0, busyTotal = 0;
+        for (double ms : frame.workerBusyMs) {
+            busyMax = std::max(busyMax, ms);
+            busyTotal += ms;
+        }
+        double busyMean = frame.workerBusyMs.empty() ? 0 : busyTotal / frame.workerBusyMs.size();
+
+        csv << frame.index << "," << frame.startMs << "," << frame.totalMs;
+        for (double ms : frame.phaseMs) {
+            csv << "," << ms;
+        }
+        csv << "," << frame.waitMs << "," << frame.kernelMs << "," << busyMax << "," << busyMean << ",";
+        if (frame.iterations >= 0)
+            csv << frame.iterations << "," << frame.maxIterationShare();
+        else
+            csv << ",";
+        // Flushed per frame so the file is usable while the program runs
+        csv << std::endl;
+    }
+
+    void writeTrace(const FrameRecord& frame) {
+        if (!trace.is_open())
+            return;
+
+        std::ostringstream event;
+        event.setf(std::ios::fixed);
+        event << "{\"name\": \"frame " << frame.index << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": " << frame.startMs * 1000.0
+              << ", \"dur\": " << frame.totalMs * 1000.0 << ", \"args\": {\"wait_ms\": " << frame.waitMs;
+        for (int p = 0; p < static_cast<int>(FramePhase::Count); p++) {
+            event << ", \"" << framePhaseName(static_cast<FramePhase>(p)) << "_ms\": " << frame.phaseMs[p];
+        }
+        if (frame.iterations >= 0)
+            event << ", \"iterations\": " << frame.iterations << ", \"max_iteration_share\": " << frame.maxIterationShare();
+        event << "}}";
+        writeTraceEvent(event.str());
+
+        for (const Span& span : spans) {
+            std::ostringstream spanEvent;
+            spanEvent.setf(std::ios::fixed);
+            spanEvent << "{\"name\": \"" << span.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": " << span.startMs * 1000.0
+                      << ", \"dur\": " << span.ms * 1000.0 << "}";
+            writeTraceEvent(spanEvent.str());
+        }
+        trace.flush();
+    }
+
+    void writeTraceEvent(const std::string& event) {
+        trace << (firstTraceEvent ? "" : ",\n") << event;
+        firstTraceEvent = false;
+    }
+};
@@ -0,0 +1,527 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IMAGE_WRITER_POSIX 1
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define IMAGE_WRITER_POSIX 0
+#include <fstream>
+#include <mutex>
+#endif
+
+// Streaming BMP / PPM writer.
+//
+// The file is created at its final size up front. Bands of finished rows
+// can then be written from any thread, in any order, each with a single
+// positional write at the offset the band has in the file, so the whole
+// image never has to be in memory.
+//
+// Pixels come in as interleaved r, g, b bytes, top row first. BMP rows are
+// stored bottom-up in BGR order and padded to a multiple of 4 bytes; a band
+// of rows is still one contiguous block of the file, just reversed.
+
+class StreamingImageWriter {
+public:
+    enum class Format { Bmp, Ppm };
+
+    // Format from the file extension (.ppm, anything else is BMP)
+    StreamingImageWriter(const std::string& filename, int width, int height)
+        : StreamingImageWriter(filename, width, height, formatOf(filename)) {}
+
+    StreamingImageWriter(const std::string& filename, int width, int height, Format format)
+        : width(width), height(height), format(format) {
+        std::vector<unsigned char> header = format == Format::Bmp ? bmpHeader() : ppmHeader();
+        headerSize = header.size();
+        rowBytes = format == Format::Bmp ? (static_cast<size_t>(width) * 3 + 3) / 4 * 4 : static_cast<size_t>(width) * 3;
+
+#if IMAGE_WRITER_POSIX
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(fileSize())) != 0) {
+            std::cerr << "Could not open file for writing." << std::endl;
+            failed = true;
+            return;
+        }
+#else
+        file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Could not open file for writing." << std::endl;
+            failed = true;
+            return;
+        }
+#endif
+        writeAt(0, header.data(), header.size());
+    }
+
+    ~StreamingImageWriter() {
+#if IMAGE_WRITER_POSIX
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    StreamingImageWriter(const StreamingImageWriter&) = delete;
+    StreamingImageWriter& operator=(const StreamingImageWriter&) = delete;
+
+    // False if the file could not be created or a write failed
+    bool isGood() const { return !failed.load(); }
+
+    size_t fileSize() const { return headerSize + rowBytes * height; }
+
+    // Writes rows y0 .. y0 + rowCount - 1. Safe to call from several threads
+    // for different rows.
+    void writeRows(int y0, int rowCount, const unsigned char* rgb) {
+        if (failed.load() || rowCount <= 0)
+            return;
+
+        thread_local std::vector<unsigned char> block;
+        block.assign(rowBytes * rowCount, 0);
+
+        for (int i = 0; i < rowCount; i++) {
+            const unsigned char* src = rgb + static_cast<size_t>(i) * width * 3;
+            if (format == Format::Bmp) {
+                // Last row of the band comes first in the file
+                unsigned char* dst = &block[(rowCount - 1 - i) * rowBytes];
+                for (int x = 0; x < width; x++) {
+                    dst[3 * x] = src[3 * x + 2];
+                    dst[3 * x + 1] = src[3 * x + 1];
+                    dst[3 * x + 2] = src[3 * x];
+                }
+            } else {
+                std::copy(src, src + static_cast<size_t>(width) * 3, &block[i * rowBytes]);
+            }
+        }
+
+        int firstFileRow = format == Format::Bmp ? height - (y0 + rowCount) : y0;
+        writeAt(headerSize + static_cast<size_t>(firstFileRow) * rowBytes, block.data(), block.size());
+    }
+
+    static Format formatOf(const std::string& filename) {
+        std::string extension = filename.size() >= 4 ? filename.substr(filename.size() - 4) : "";
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+        return extension == ".ppm" ? Format::Ppm : Format::Bmp;
+    }
+
+private:
+    int width;
+    int height;
+    Format format;
+    size_t headerSize = 0;
+    size_t rowBytes = 0;
+    std::atomic<bool> failed{false};
+
+#if IMAGE_WRITER_POSIX
+    int fd = -1;
+#else
+    std::ofstream file;
+    std::mutex mtx;
+#endif
+
+    void writeAt(size_t offset, const unsigned char* data, size_t size) {
+#if IMAGE_WRITER_POSIX
+        while (size > 0) {
+            ssize_t n = pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (n <= 0) {
+                failed = true;
+                return;
+            }
+            data += n;
+            offset += static_cast<size_t>(n);
+            size -= static_cast<size_t>(n);
+        }
+#else
+        std::lock_guard<std::mutex> lock(mtx);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!file)
+            failed = true;
+#endif
+    }
+
+    static void putLittleEndian(unsigned char* dst, uint32_t value) {
+        dst[0] = static_cast<unsigned char>(value);
+        dst[1] = static_cast<unsigned char>(value >> 8);
+        dst[2] = static_cast<unsigned char>(value >> 16);
+        dst[3] = static_cast<unsigned char>(value >> 24);
+    }
+
+    std::vector<unsigned char> bmpHeader() const {
+        std::vector<unsigned char> header(54, 0);
+        size_t padded = (static_cast<size_t>(width) * 3 + 3) / 4 * 4;
+        size_t imageSize = padded * height;
+
+        header[0] = 'B';
+        header[1] = 'M';
+        // Sizes above 4 GB do not fit the header; most readers go by the
+        // dimensions instead
+        putLittleEndian(&header[2], static_cast<uint32_t>(std::min<size_t>(54 + imageSize, UINT32_MAX)));
+        header[10] = 54;
+
+        header[14] = 40;
+        putLittleEndian(&header[18], static_cast<uint32_t>(width));
+        putLittleEndian(&header[22], static_cast<uint32_t>(height));
+        header[26] = 1;  // Planes
+        header[28] = 24; // Bits per pixel
+        putLittleEndian(&header[34], static_cast<uint32_t>(std::min<size_t>(imageSize, UINT32_MAX)));
+        return header;
+    }
+
+    std::vector<unsigned char> ppmHeader() const {
+        std::string text = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        return std::vector<unsigned char>(text.begin(), text.end());
+    }
+};
+
+// Tiled BigTIFF writer for images too large to hold in memory (or to fit the
+// 4 GB of a classic TIFF / BMP).
+//
+// Every tile has a fixed place in the file, and the directory with all tile
+// offsets is written when the file is created, so the file is a valid TIFF
+// from the start and tiles can be filled in any order, from any thread, and
+// across restarts: reopening an existing file of the same size keeps the
+// tiles already in it. Edge tiles are padded to the full tile size as TIFF
+// requires.
+
+class TiledTiffWriter {
+public:
+    TiledTiffWriter(const std::string& filename, int width, int height, int tileSize, bool keepExisting = false)
+        : width(width), height(height), tileSize(tileSize) {
+        tilesX = (width + tileSize - 1) / tileSize;
+        tilesY = (height + tileSize - 1) / tileSize;
+        tileBytes = static_cast<uint64_t>(tileSize) * tileSize * 3;
+        std::vector<unsigned char> directory = makeDirectory();
+
+#if IMAGE_WRITER_POSIX
+        uint64_t size = directoryOffset() + directory.size();
+        fd = ::open(filename.c_str(), O_RDWR | O_CREAT | (keepExisting ? 0 : O_TRUNC), 0644);
+        struct stat info;
+        reused = fd >= 0 && keepExisting && fstat(fd, &info) == 0 && static_cast<uint64_t>(info.st_size) == size;
+        if (fd < 0 || (!reused && (ftruncate(fd, 0) != 0 || ftruncate(fd, static_cast<off_t>(size)) != 0))) {
+            std::cerr << "Could not open file for writing." << std::endl;
+            failed = true;
+            return;
+        }
+        if (!reused) {
+            writeAt(0, directory.data(), 16);
+            writeAt(directoryOffset(), directory.data() + 16, directory.size() - 16);
+        }
+#else
+        (void)filename;
+        (void)keepExisting;
+        std::cerr << "Tiled output needs a POSIX system." << std::endl;
+        failed = true;
+#endif
+    }
+
+    ~TiledTiffWriter() {
+#if IMAGE_WRITER_POSIX
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    TiledTiffWriter(const TiledTiffWriter&) = delete;
+    TiledTiffWriter& operator=(const TiledTiffWriter&) = delete;
+
+    bool isGood() const { return !failed.load(); }
+
+    // True if an existing file of the same layout was opened, whose tiles
+    // are kept
+    bool isReused() const { return reused; }
+
+    int getTilesX() const { return tilesX; }
+    int getTilesY() const { return tilesY; }
+    int getTileCount() const { return tilesX * tilesY; }
+
+    // Writes tile (tx, ty) from interleaved r, g, b bytes with rows of
+    // tileSize pixels. Safe to call from several threads for different tiles.
+    void writeTile(int tx, int ty, const unsigned char* rgb) {
+        if (!failed.load())
+            writeAt(16 + tileBytes * (static_cast<uint64_t>(ty) * tilesX + tx), rgb, tileBytes);
+    }
+
+    // Flushes the tiles written so far to the disk
+    bool sync() {
+#if IMAGE_WRITER_POSIX
+        if (fd >= 0 && fsync(fd) != 0)
+            failed = true;
+#endif
+        return isGood();
+    }
+
+private:
+    int width;
+    int height;
+    int tileSize;
+    int tilesX = 0;
+    int tilesY = 0;
+    uint64_t tileBytes = 0;
+    bool reused = false;
+    std::atomic<bool> failed{false};
+
+#if IMAGE_WRITER_POSIX
+    int fd = -1;
+#endif
+
+    uint64_t directoryOffset() const { return 16 + tileBytes * static_cast<uint64_t>(tilesX) * tilesY; }
+
+    void writeAt(uint64_t offset, const unsigned char* data, uint64_t size) {
+#if IMAGE_WRITER_POSIX
+        while (size > 0) {
+            ssize_t n = pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (n <= 0) {
+                failed = true;
+                return;
+            }
+            data += n;
+            offset += static_cast<uint64_t>(n);
+            size -= static_cast<uint64_t>(n);
+        }
+#else
+        (void)offset;
+        (void)data;
+        (void)size;
+#endif
+    }
+
+    static void put(std::vector<unsigned char>& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+        }
+    }
+
+    // BigTIFF header (first 16 bytes) followed by the directory, which goes
+    // after the tile data
+    std::vector<unsigned char> makeDirectory() const {
+        const int SHORT = 3, LONG = 4, LONG8 = 16;
+        uint64_t tileCount = static_cast<uint64_t>(tilesX) * tilesY;
+        uint64_t ifd = directoryOffset();
+        const int entryCount = 11;
+        uint64_t arrays = ifd + 8 + entryCount * 20 + 8;
+
+        std::vector<unsigned char> out;
+        out.push_back('I');
+        out.push_back('I');
+        put(out, 43, 2); // BigTIFF
+        put(out, 8, 2);  // Offset size
+        put(out, 0, 2);
+        put(out, ifd, 8);
+
+        auto entry = [&](int tag, int type, uint64_t count, uint64_t value) {
+            put(out, tag, 2);
+            put(out, type, 2);
+            put(out, count, 8);
+            put(out, value, 8);
+        };
+        put(out, entryCount, 8);
+        entry(256, LONG, 1, width);                          // ImageWidth
+        entry(257, LONG, 1, height);                         // ImageLength
+        entry(258, SHORT, 3, 8 | (8ull << 16) | (8ull << 32)); // BitsPerSample
+        entry(259, SHORT, 1, 1);                             // Compression: none
+        entry(262, SHORT, 1, 2);                             // Photometric: RGB
+        entry(277, SHORT, 1, 3);                             // SamplesPerPixel
+        entry(284, SHORT, 1, 1);                             // PlanarConfiguration: chunky
+        entry(322, LONG, 1, tileSize);                       // TileWidth
+        entry(323, LONG, 1, tileSize);                       // TileLength
+        entry(324, LONG8, tileCount, tileCount == 1 ? 16 : arrays);                        // TileOffsets
+        entry(325, LONG8, tileCount, tileCount == 1 ? tileBytes : arrays + 8 * tileCount); // TileByteCounts
+        put(out, 0, 8); // No next directory
+
+        if (tileCount > 1) {
+            for (uint64_t i = 0; i < tileCount; i++) {
+                put(out, 16 + i * tileBytes, 8);
+            }
+            for (uint64_t i = 0; i < tileCount; i++) {
+                put(out, tileBytes, 8);
+            }
+        }
+        return out;
+    }
+};
+
+// In-memory PNG encoder for small images such as map tiles.
+//
+// The pixels are deflated with the fixed Huffman codes and only two kinds of
+// match: a repeat of the pixel to the left (distance 3) and of the pixel above
+// (distance one row). That costs one pass over the data, and the flat areas
+// and bands of a fractal tile still shrink by a large factor.
+
+class PngEncoder {
+public:
+    // rgb is interleaved r, g, b bytes, top row first
+    static std::vector<unsigned char> encode(int width, int height, const unsigned char* rgb) {
+        size_t rowBytes = static_cast<size_t>(width) * 3 + 1;
+        std::vector<unsigned char> raw(rowBytes * height);
+        for (int y = 0; y < height; y++) {
+            raw[y * rowBytes] = 0; // Filter: none
+            std::copy_n(rgb + static_cast<size_t>(y) * width * 3, width * 3, &raw[y * rowBytes + 1]);
+        }
+
+        std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        std::vector<unsigned char> header(13, 0);
+        putBigEndian(&header[0], static_cast<uint32_t>(width));
+        putBigEndian(&header[4], static_cast<uint32_t>(height));
+        header[8] = 8; // Bits per sample
+        header[9] = 2; // Color type: RGB
+        chunk(png, "IHDR", header);
+        chunk(png, "IDAT", zlib(raw, rowBytes));
+        chunk(png, "IEND", {});
+        return png;
+    }
+
+private:
+    struct BitWriter {
+        std::vector<unsigned char>& out;
+        uint32_t bits = 0;
+        int count = 0;
+
+        // Extra bits and block headers go least significant bit first
+        void put(uint32_t value, int length) {
+            bits |= value << count;
+            count += length;
+            while (count >= 8) {
+                out.push_back(static_cast<unsigned char>(bits));
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes go most significant bit first
+        void code(uint32_t value, int length) {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++) {
+                reversed |= ((value >> i) & 1) << (length - 1 - i);
+            }
+            put(reversed, length);
+        }
+
+        void flush() {
+            if (count > 0)
+                out.push_back(static_cast<unsigned char>(bits));
+            bits = 0;
+            count = 0;
+        }
+    };
+
+    static void putBigEndian(unsigned char* dst, uint32_t value) {
+        dst[0] = static_cast<unsigned char>(value >> 24);
+        dst[1] = static_cast<unsigned char>(value >> 16);
+        dst[2] = static_cast<unsigned char>(value >> 8);
+        dst[3] = static_cast<unsigned char>(value);
+    }
+
+    static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0xFFFFFFFFu) {
+        static const std::vector<uint32_t> table = []() {
+            std::vector<uint32_t> t(256);
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+        for (size_t i = 0; i < size; i++) {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    static void chunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data) {
+        unsigned char length[4];
+        putBigEndian(length, static_cast<uint32_t>(data.size()));
+        png.insert(png.end(), length, length + 4);
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        unsigned char crc[4];
+        putBigEndian(crc, crc32(&png[start], png.size() - start) ^ 0xFFFFFFFFu);
+        png.insert(png.end(), crc, crc + 4);
+    }
+
+    // Literal / end of block / length symbol with the fixed code
+    static void symbol(BitWriter& writer, int value) {
+        if (value < 144)
+            writer.code(0x30 + value, 8);
+        else if (value < 256)
+            writer.code(0x190 + value - 144, 9);
+        else if (value < 280)
+            writer.code(value - 256, 7);
+        else
+            writer.code(0xC0 + value - 280, 8);
+    }
+
+    static void match(BitWriter& writer, int length, int distance) {
+        static const int lengthBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int lengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const int distanceBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+                                           4097, 6145, 8193, 12289, 16385, 24577};
+        static const int distanceExtra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        int l = 28;
+        while (lengthBase[l] > length) l--;
+        symbol(writer, 257 + l);
+        writer.put(length - lengthBase[l], lengthExtra[l]);
+
+        int d = 29;
+        while (distanceBase[d] > distance) d--;
+        writer.code(d, 5);
+        writer.put(distance - distanceBase[d], distanceExtra[d]);
+    }
+
+    static std::vector<unsigned char> zlib(const std::vector<unsigned char>& raw, size_t rowBytes) {
+        std::vector<unsigned char> out = {0x78, 0x01};
+        BitWriter writer{out};
+        writer.put(1, 1); // Final block
+        writer.put(1, 2); // Fixed Huffman codes
+
+        // Rows longer than the deflate window only get the left matches
+        size_t distances[] = {3, rowBytes <= 32768 ? rowBytes : 0};
+        size_t i = 0;
+        while (i < raw.size()) {
+            size_t bestLength = 0, bestDistance = 0;
+            for (size_t distance : distances) {
+                if (distance == 0 || distance > i)
+                    continue;
+                size_t length = 0;
+                while (length < 258 && i + length < raw.size() && raw[i + length] == raw[i + length - distance]) {
+                    length++;
+                }
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = distance;
+                }
+            }
+
+            if (bestLength >= 3) {
+                match(writer, static_cast<int>(bestLength), static_cast<int>(bestDistance));
+                i += bestLength;
+            } else {
+                symbol(writer, raw[i]);
+                i++;
+            }
+        }
+        symbol(writer, 256);
+        writer.flush();
+
+        uint32_t a = 1, b = 0;
+        for (unsigned char byte : raw) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        unsigned char adler[4];
+        putBigEndian(adler, (b << 16) | a);
+        out.insert(out.end(), adler, adler + 4);
+        return out;
+    }
+};
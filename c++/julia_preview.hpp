@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include "fractal_kernel.hpp"
+#include "mandelbrot_palette.hpp"
+#include "tile_scheduler.hpp"
+
+// Live preview of the Julia set for a c that follows the mouse.
+//
+// The preview runs on a TileScheduler of its own, on cores set aside from the
+// main render pool, so a preview frame never waits for the main frame and the
+// main frame never waits for the preview. Only the last requested c is kept:
+// mouse positions passed while a frame was rendering are dropped.
+//
+// Every frame has to fit into a time budget. The pixel step and iteration cap
+// are planned per frame from the frames before: the time per iteration, the
+// share of pixels that ran to the cap and the mean count of the others. As
+// the mouse moves continuously, the next Julia set costs about what the last
+// one did. Rows that would start after the deadline are skipped and such a
+// frame is dropped (the previous one stays on screen), so a wrong guess costs
+// one frame, and the model makes the next one smaller.
+
+template <typename Color>
+class JuliaPreview {
+public:
+    JuliaPreview(TileScheduler& scheduler, int width, int height, int maxIterations, double budgetMs = 8.0)
+        : scheduler(scheduler), width(width), height(height), maxIterations(maxIterations), budgetMs(budgetMs),
+          kernel(juliaSpec()), front(static_cast<size_t>(width) * height), back(static_cast<size_t>(width) * height) {}
+
+    ~JuliaPreview() {
+        scheduler.cancel();
+        scheduler.wait();
+    }
+
+    JuliaPreview(const JuliaPreview&) = delete;
+    JuliaPreview& operator=(const JuliaPreview&) = delete;
+
+    // Replaces whatever c was requested before and not started yet
+    void request(double real, double imag) {
+        requestedReal = real;
+        requestedImag = imag;
+        requested = true;
+    }
+
+    // Call on every turn of the main loop; never blocks on the workers.
+    // Collects a finished frame and starts the next requested one. True if a
+    // new frame is ready in data().
+    bool update(const Palette<Color>& palette) {
+        bool ready = false;
+        if (rendering) {
+            if (!scheduler.isDone())
+                return false;
+            rendering = false;
+            ready = finishFrame();
+        }
+        if (requested) {
+            requested = false;
+            startFrame(palette);
+        }
+        return ready;
+    }
+
+    // The last complete frame: getFrameWidth() x getFrameHeight() pixels, each
+    // standing for getStep() x getStep() pixels of the pane
+    const Color* data() const { return front.data(); }
+    int getFrameWidth() const { return shown.frameWidth; }
+    int getFrameHeight() const { return shown.frameHeight; }
+    int getStep() const { return shown.step; }
+    int getIterationCap() const { return shown.iterationCap; }
+    double getReal() const { return shown.real; }
+    double getImag() const { return shown.imag; }
+    double getLastMs() const { return lastMs; } // Of the last frame, shown or dropped
+    int getDroppedFrames() const { return droppedFrames; }
+
+private:
+    // Preview pixels per side, from fine to coarse
+    static constexpr int STEPS[] = {1, 2, 3, 4, 6, 8};
+    static constexpr int MIN_ITERATIONS = 64;
+    // Part of the budget the plan may use; the rest absorbs the estimate being off
+    static constexpr double HEADROOM = 0.7;
+
+    struct Plan {
+        int step = 4;
+        int iterationCap = MIN_ITERATIONS;
+        int frameWidth = 0;
+        int frameHeight = 0;
+        double real = 0;
+        double imag = 0;
+    };
+
+    TileScheduler& scheduler;
+    int width;
+    int height;
+    int maxIterations;
+    double budgetMs;
+
+    // Looked up once; each frame copies it with its own c
+    FractalKernel<float> kernel;
+
+    std::vector<Color> front; // Shown
+    std::vector<Color> back;  // Being rendered
+    Palette<Color> framePalette;
+    Plan shown;
+    Plan current;
+
+    double requestedReal = 0;
+    double requestedImag = 0;
+    bool requested = false;
+    bool rendering = false;
+
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point deadline;
+    std::atomic<bool> overBudget{false};
+    std::atomic<long long> iterationSum{0};
+    std::atomic<long long> cappedPixels{0};
+    std::atomic<long long> renderedPixels{0};
+
+    // Cost model, fitted to the frames so far (msPerIteration 0 until the first)
+    double msPerIteration = 0;
+    double cappedShare = 0;  // Of the pixels, ran to the cap
+    double escapedMean = 0;  // Mean count of the others
+    double lastMs = 0;
+    int droppedFrames = 0;
+
+    static FractalSpec juliaSpec() {
+        FractalSpec spec;
+        spec.julia = true;
+        return spec;
+    }
+
+    double predictMs(int step, int iterationCap) const {
+        double pixels = static_cast<double>((width + step - 1) / step) * ((height + step - 1) / step);
+        // A pixel costs at least one iteration worth of time, even when it escapes at once
+        double perPixel = cappedShare * iterationCap + (1 - cappedShare) * std::min<double>(escapedMean, iterationCap) + 1;
+        return pixels * perPixel * msPerIteration;
+    }
+
+    // The finest step with at least a quarter of the iterations, else the
+    // coarsest step with as many iterations as fit
+    Plan plan() const {
+        Plan next;
+        if (msPerIteration == 0) {
+            next.step = 4;
+            next.iterationCap = std::max(MIN_ITERATIONS, maxIterations / 4);
+            return next;
+        }
+
+        int minCap = std::max(MIN_ITERATIONS, maxIterations / 4);
+        for (int step : STEPS) {
+            for (int cap = maxIterations; cap >= minCap; cap /= 2) {
+                if (predictMs(step, cap) <= budgetMs * HEADROOM) {
+                    next.step = step;
+                    next.iterationCap = cap;
+                    return next;
+                }
+            }
+        }
+
+        next.step = STEPS[sizeof(STEPS) / sizeof(STEPS[0]) - 1];
+        next.iterationCap = minCap;
+        while (next.iterationCap > MIN_ITERATIONS && predictMs(next.step, next.iterationCap) > budgetMs * HEADROOM) {
+            next.iterationCap /= 2;
+        }
+        next.iterationCap = std::max(MIN_ITERATIONS, next.iterationCap);
+        return next;
+    }
+
+    void startFrame(const Palette<Color>& palette) {
+        current = plan();
+        current.frameWidth = (width + current.step - 1) / current.step;
+        current.frameHeight = (height + current.step - 1) / current.step;
+        current.real = requestedReal;
+        current.imag = requestedImag;
+
+        // The workers keep their own copy, so the caller can change palettes
+        framePalette = palette;
+        overBudget = false;
+        iterationSum = 0;
+        cappedPixels = 0;
+        renderedPixels = 0;
+        startTime = std::chrono::steady_clock::now();
+        deadline = startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(budgetMs));
+
+        FractalKernel<float> frameKernel = kernel;
+        frameKernel.setJuliaC(current.real, current.imag);
+
+        // The set lies within |z| <= 2, which fits the shorter side
+        double pixelSize = 4.0 / std::min(width, height) * current.step;
+        scheduler.submit(scheduler.makeTiles(current.frameWidth, current.frameHeight), [this, frameKernel, pixelSize](const Tile& tile) {
+            renderTile(tile, frameKernel, pixelSize);
+        });
+        rendering = true;
+    }
+
+    void renderTile(const Tile& tile, const FractalKernel<float>& kernel, double pixelSize) {
+        thread_local std::vector<float> real;
+        thread_local std::vector<int> iterations;
+        int count = tile.x1 - tile.x0;
+        real.resize(count);
+        iterations.resize(count);
+        for (int i = 0; i < count; i++) {
+            real[i] = static_cast<float>((tile.x0 + i + 0.5 - current.frameWidth / 2.0) * pixelSize);
+        }
+
+        int cap = current.iterationCap;
+        int paletteMax = framePalette.getMaxIterations();
+        long long sum = 0, capped = 0, rendered = 0;
+        for (int y = tile.y0; y < tile.y1; y++) {
+            if (overBudget.load(std::memory_order_relaxed) || std::chrono::steady_clock::now() > deadline) {
+                overBudget = true;
+                break;
+            }
+            float imag = static_cast<float>((y + 0.5 - current.frameHeight / 2.0) * pixelSize);
+            kernel.iterateRow(real.data(), imag, count, cap, iterations.data());
+
+            // Counts are spread over the whole palette whatever the cap
+            Color* out = &back[static_cast<size_t>(y) * current.frameWidth + tile.x0];
+            for (int i = 0; i < count; i++) {
+                int n = iterations[i];
+                sum += n;
+                capped += n >= cap;
+                out[i] = framePalette[n >= cap ? paletteMax : static_cast<int>(static_cast<long long>(n) * paletteMax / cap)];
+            }
+            rendered += count;
+        }
+        iterationSum += sum;
+        cappedPixels += capped;
+        renderedPixels += rendered;
+    }
+
+    // Updates the model from the frame just done; shows it if it is complete
+    bool finishFrame() {
+        scheduler.wait();
+        lastMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+        // A dropped frame got through only some of its rows, which still
+        // tell what its pixels cost
+        long long pixels = renderedPixels.load();
+        long long capped = cappedPixels.load();
+        long long sum = iterationSum.load();
+        if (pixels > 0) {
+            cappedShare = static_cast<double>(capped) / pixels;
+            escapedMean = pixels > capped ? static_cast<double>(sum - capped * current.iterationCap) / (pixels - capped) : 0;
+            double measured = lastMs / (static_cast<double>(sum) + pixels);
+            msPerIteration = msPerIteration == 0 ? measured : 0.5 * msPerIteration + 0.5 * measured;
+        }
+
+        if (overBudget) {
+            droppedFrames++;
+            return false;
+        }
+        std::swap(front, back);
+        shown = current;
+        return true;
+    }
+};
@@ -1,7 +1,12 @@
 #include <SFML/Graphics.hpp>
-#include <complex>
+#include <cmath>
+#include <vector>
 
-// g++ -o mandelbrot mandelbrot.cpp -lsfml-graphics -lsfml-window -lsfml-system && ./mandelbrot
+#include "mandelbrot_kernel.hpp"
+#include "mandelbrot_palette.hpp"
+#include "tile_scheduler.hpp"
+
+// g++ -O2 -o mandelbrot mandelbrot.cpp -lsfml-graphics -lsfml-window -lsfml-system -pthread && ./mandelbrot
 
 const int WIDTH = 1920;
 const int HEIGHT = 1080;
@@ -28,34 +33,33 @@ sf::Color getColor2(int iterations) {
     return sf::Color(r, g, b);
 }
 
-int mandelbrot(double real, double imag) {
-    std::complex<double> point(real, imag);
-    std::complex<double> z(0, 0);
-    int iterations = 0;
-
-    while (abs(z) < 2 && iterations < MAX_ITERATIONS) {
-        z = z * z + point;
-        iterations++;
-    }
-
-    return iterations;
-}
-
 int main() {
     sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "Mandelbrot Set");
     sf::Image image;
     image.create(WIDTH, HEIGHT, sf::Color(0, 0, 0));
 
+    std::vector<double> real(WIDTH);
+
     for (int x = 0; x < WIDTH; ++x) {
-        for (int y = 0; y < HEIGHT; ++y) {
-            double real = (x - WIDTH / 2.0) * 4.0 / WIDTH;
+        real[x] = (x - WIDTH / 2.0) * 4.0 / WIDTH;
+    }
+
+    // Iteration counts are kept, so the frame can be colored separately
+    std::vector<int> iterations(WIDTH * HEIGHT);
+
+    TileScheduler scheduler;
+    scheduler.run(WIDTH, HEIGHT, [&](const Tile& tile) {
+        for (int y = tile.y0; y < tile.y1; ++y) {
             double imag = (y - HEIGHT / 2.0) * 4.0 / WIDTH;
-            int value = mandelbrot(real, imag);
-            sf::Color color = getColor(value);
-            //sf::Color color = getColor2(value);
-            image.setPixel(x, y, color);
+            mandelbrotRow(real.data() + tile.x0, imag, tile.x1 - tile.x0, MAX_ITERATIONS, &iterations[y * WIDTH + tile.x0]);
         }
-    }
+    });
+
+    Palette<sf::Color> palette(MAX_ITERATIONS, getColor);
+    //Palette<sf::Color> palette(MAX_ITERATIONS, getColor2);
+    std::vector<sf::Color> pixels(WIDTH * HEIGHT);
+    palette.colorize(iterations.data(), WIDTH * HEIGHT, pixels.data());
+    image.create(WIDTH, HEIGHT, reinterpret_cast<const sf::Uint8*>(pixels.data()));
 
     image.saveToFile("mandelbrot.png");
 
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Adaptive anti-aliasing of rendered rows.
+//
+// Supersampling the whole image costs N^2 times the render. Most of the image
+// is smooth, though, and only pixels on a visible edge need more samples: a
+// pixel whose color differs from one of its four neighbors by more than a
+// threshold (summed over r, g and b) is sampled again at jittered points on a
+// grid x grid raster inside it, and gets the average color of the samples.
+// Everything else keeps its single sample.
+//
+// Edge pixels are sampled in two rounds: first one cell of each quadrant of
+// the raster, and only where those samples disagree with each other the rest
+// of the cells. Pixels that merely border an edge are settled by the first
+// round.
+//
+// The edge test uses the colors, not the iteration counts, so a change of a
+// few iterations far outside the set, which the palette does not show, costs
+// nothing, while the boundary of the set always counts.
+//
+// The jitter is a hash of the pixel and sample position, so the image does not
+// depend on which thread rendered which rows.
+//
+// Color needs r, g and b members and must be constructible from {r, g, b}.
+
+template <typename Color>
+class EdgeAntialiaser {
+public:
+    explicit EdgeAntialiaser(int grid = 4, int threshold = 24) : grid(std::max(1, grid)), threshold(threshold) {
+        std::vector<char> isCoarse(this->grid * this->grid, this->grid < 2);
+        if (this->grid >= 2) {
+            for (int j : {this->grid / 4, 3 * this->grid / 4}) {
+                for (int i : {this->grid / 4, 3 * this->grid / 4}) {
+                    isCoarse[j * this->grid + i] = 1;
+                }
+            }
+        }
+        for (int cell = 0; cell < this->grid * this->grid; cell++) {
+            (isCoarse[cell] ? coarseCells : fineCells).push_back(cell);
+        }
+    }
+
+    // At most; pixels settled by the first round get fewer
+    int getSamplesPerPixel() const { return grid * grid; }
+
+    // rows holds the colors of image rows r0 .. r1 - 1 (width each), which
+    // include the rows y0 .. y1 - 1 to fix plus their neighbors where there
+    // are any. sample(x, y, count, iterations) iterates count points given in
+    // pixel coordinates, where pixel (px, py) is sampled at x = px, y = py.
+    // Returns the number of pixels supersampled.
+    template <typename Palette, typename SampleFn>
+    int apply(Color* rows, int width, int r0, int r1, int y0, int y1, const Palette& palette, const SampleFn& sample) const {
+        thread_local std::vector<int> edges, refined;
+        thread_local std::vector<int> coarse, fine;
+        edges.clear();
+        refined.clear();
+
+        // All edges are found before any pixel changes
+        for (int y = y0; y < y1; y++) {
+            const Color* row = rows + static_cast<size_t>(y - r0) * width;
+            for (int x = 0; x < width; x++) {
+                bool edge = (x > 0 && differs(row[x], row[x - 1])) || (x + 1 < width && differs(row[x], row[x + 1])) ||
+                            (y > r0 && differs(row[x], row[x - width])) || (y + 1 < r1 && differs(row[x], row[x + width]));
+                if (edge)
+                    edges.push_back((y - r0) * width + x);
+            }
+        }
+
+        sampleCells(edges, coarseCells, width, r0, sample, coarse);
+        size_t coarseCount = coarseCells.size();
+        for (size_t e = 0; e < edges.size(); e++) {
+            bool agree = true;
+            for (size_t s = 1; s < coarseCount && agree; s++) {
+                agree = !differs(palette[coarse[e * coarseCount + s]], palette[coarse[e * coarseCount]]);
+            }
+            if (!agree && !fineCells.empty())
+                refined.push_back(static_cast<int>(e));
+            else
+                rows[edges[e]] = average(palette, &coarse[e * coarseCount], coarseCount, nullptr, 0);
+        }
+
+        thread_local std::vector<int> refinedPixels;
+        refinedPixels.clear();
+        for (int e : refined) {
+            refinedPixels.push_back(edges[e]);
+        }
+        sampleCells(refinedPixels, fineCells, width, r0, sample, fine);
+        size_t fineCount = fineCells.size();
+        for (size_t i = 0; i < refined.size(); i++) {
+            rows[refinedPixels[i]] = average(palette, &coarse[refined[i] * coarseCount], coarseCount, &fine[i * fineCount], fineCount);
+        }
+        return static_cast<int>(edges.size());
+    }
+
+private:
+    int grid;
+    int threshold;
+    std::vector<int> coarseCells; // Raster cells of the first round
+    std::vector<int> fineCells;   // and of the second
+
+    // Iterates the given cells of each pixel (an offset into rows starting at
+    // row r0) as one batch, which keeps the SIMD lanes full
+    template <typename SampleFn>
+    void sampleCells(const std::vector<int>& pixels, const std::vector<int>& cells, int width, int r0, const SampleFn& sample,
+                     std::vector<int>& iterations) const {
+        thread_local std::vector<double> sampleX, sampleY;
+        sampleX.clear();
+        sampleY.clear();
+        for (int pixel : pixels) {
+            int x = pixel % width, y = r0 + pixel / width;
+            for (int cell : cells) {
+                sampleX.push_back(x - 0.5 + (cell % grid + jitter(x, y, 2 * cell)) / grid);
+                sampleY.push_back(y - 0.5 + (cell / grid + jitter(x, y, 2 * cell + 1)) / grid);
+            }
+        }
+        int count = static_cast<int>(sampleX.size());
+        iterations.resize(count);
+        if (count > 0)
+            sample(sampleX.data(), sampleY.data(), count, iterations.data());
+    }
+
+    template <typename Palette>
+    static Color average(const Palette& palette, const int* a, size_t countA, const int* b, size_t countB) {
+        int r = 0, g = 0, bl = 0;
+        for (size_t i = 0; i < countA + countB; i++) {
+            const Color& color = palette[i < countA ? a[i] : b[i - countA]];
+            r += color.r;
+            g += color.g;
+            bl += color.b;
+        }
+        int n = static_cast<int>(countA + countB);
+        return Color{static_cast<unsigned char>((r + n / 2) / n), static_cast<unsigned char>((g + n / 2) / n), static_cast<unsigned char>((bl + n / 2) / n)};
+    }
+
+    bool differs(const Color& a, const Color& b) const {
+        return std::abs(a.r - b.r) + std::abs(a.g - b.g) + std::abs(a.b - b.b) > threshold;
+    }
+
+    // Offset in [0, 1) for sample s of pixel (x, y)
+    static double jitter(int x, int y, int s) {
+        uint32_t h = static_cast<uint32_t>(x) * 0x9E3779B1u ^ static_cast<uint32_t>(y) * 0x85EBCA77u ^ static_cast<uint32_t>(s) * 0xC2B2AE3Du;
+        h ^= h >> 16;
+        h *= 0x7FEB352Du;
+        h ^= h >> 15;
+        h *= 0x846CA68Bu;
+        h ^= h >> 16;
+        return (h >> 8) * (1.0 / 16777216.0);
+    }
+};
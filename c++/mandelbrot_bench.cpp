@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mandelbrot_kernel.hpp"
+#include "mandelbrot_subdivision.hpp"
+#include "tile_scheduler.hpp"
+
+// Headless benchmark: renders a fixed set of viewpoints with every kernel /
+// scheduler variant and prints the results as JSON, so builds can be compared
+// without opening a window.
+//
+// g++ -O2 -o mandelbrot_bench mandelbrot_bench.cpp -pthread && ./mandelbrot_bench > bench.json
+// Number of timed frames per variant (default 7):
+// g++ -O2 -o mandelbrot_bench mandelbrot_bench.cpp -pthread && ./mandelbrot_bench 21 > bench.json
+
+const int WIDTH = 1280;
+const int HEIGHT = 800;
+
+// Same mapping as the interactive programs: the view spans 2 / zoom in both
+// directions around the center
+struct Viewpoint {
+    std::string name;
+    double zoom;
+    double real;
+    double imag;
+    int maxIterations;
+};
+
+struct Variant {
+    std::string name;
+    KernelIsa isa;
+    KernelOptions options;
+    unsigned threads;
+    int tileSize;
+    bool subdivision = false;
+};
+
+struct Result {
+    std::vector<double> frameMs;
+    long long iterations = 0; // Sum of the counts of one frame, also the checksum
+                              // (pixels skipped by the shortcuts still count)
+    double imbalance = 0;     // Slowest worker over the average, minus 1
+};
+
+std::vector<Viewpoint> loadViewpoints() {
+    std::vector<Viewpoint> viewpoints = {
+        {"full_set", 0.8, -0.75, 0.0, 1000},
+        {"seahorse_valley", 200.0, -0.743643887037158704752191506114774, 0.131825904205311970493132056385139, 2000},
+        {"last_coordinates", 468596, -1.39535, -0.113084, 5000},
+        {"all_interior", 20.0, -0.1, 0.0, 1000},
+    };
+
+    // The deep point comes from the interactive program when it is there
+    std::ifstream in("last_coordinates.txt");
+    double zoom, real, imag;
+    if (in >> zoom >> real >> imag) {
+        viewpoints[2].zoom = zoom;
+        viewpoints[2].real = real;
+        viewpoints[2].imag = imag;
+    }
+    return viewpoints;
+}
+
+std::vector<Variant> makeVariants() {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    KernelOptions shortcuts;
+    KernelOptions noShortcuts{false, false};
+    KernelIsa best = detectKernelIsa();
+
+    std::vector<Variant> variants;
+    for (KernelIsa isa : {KernelIsa::Scalar, KernelIsa::Avx2, KernelIsa::Avx512}) {
+        if (static_cast<int>(isa) > static_cast<int>(best))
+            continue;
+        variants.push_back({std::string(kernelIsaName(isa)), isa, shortcuts, cores, 32});
+        variants.push_back({std::string(kernelIsaName(isa)) + "_no_shortcuts", isa, noShortcuts, cores, 32});
+    }
+
+    std::string bestName = kernelIsaName(best);
+    variants.push_back({bestName + "_1_thread", best, shortcuts, 1, 32});
+    variants.push_back({bestName + "_tile_16", best, shortcuts, cores, 16});
+    variants.push_back({bestName + "_tile_64", best, shortcuts, cores, 64});
+    variants.push_back({bestName + "_subdivision", best, shortcuts, cores, 32, true});
+    return variants;
+}
+
+std::vector<WorkerStats> renderFrame(const Viewpoint& view, const Variant& variant, MandelbrotRowFn<double> rowFn, TileScheduler& scheduler,
+                                     std::vector<int>& iterations) {
+    double pixelWidth = 1.0 / (0.5 * view.zoom * WIDTH);
+    double pixelHeight = 1.0 / (0.5 * view.zoom * HEIGHT);
+    std::vector<double> real(WIDTH);
+    for (int x = 0; x < WIDTH; x++) {
+        real[x] = view.real + (x - WIDTH / 2.0) * pixelWidth;
+    }
+
+    auto iterateRow = [&](int y, int x0, int x1, int* out) {
+        double imag = view.imag + (y - HEIGHT / 2.0) * pixelHeight;
+        mandelbrotRow(rowFn, real.data() + x0, imag, x1 - x0, view.maxIterations, out, variant.options);
+    };
+
+    if (variant.subdivision) {
+        auto iterateColumn = [&](int x, int y0, int y1, int* out) {
+            thread_local std::vector<double> columnReal, columnImag;
+            columnReal.assign(y1 - y0, real[x]);
+            columnImag.resize(y1 - y0);
+            for (int y = y0; y < y1; y++) {
+                columnImag[y - y0] = view.imag + (y - HEIGHT / 2.0) * pixelHeight;
+            }
+            mandelbrotPoints(rowFn, columnReal.data(), columnImag.data(), y1 - y0, view.maxIterations, out, variant.options);
+        };
+        return scheduler.run(WIDTH, HEIGHT, [&](const Tile& tile) {
+            TileSubdivider<decltype(iterateRow), decltype(iterateColumn)> subdivider(WIDTH, iterations.data(), iterateRow, iterateColumn);
+            subdivider.render(tile);
+        });
+    }
+
+    return scheduler.run(WIDTH, HEIGHT, [&](const Tile& tile) {
+        for (int y = tile.y0; y < tile.y1; y++) {
+            iterateRow(y, tile.x0, tile.x1, &iterations[y * WIDTH + tile.x0]);
+        }
+    });
+}
+
+Result runVariant(const Viewpoint& view, const Variant& variant, TileScheduler& scheduler, int frames) {
+    MandelbrotRowFn<double> rowFn = selectMandelbrotRow<double>(variant.isa);
+    std::vector<int> iterations(WIDTH * HEIGHT);
+    Result result;
+
+    // One untimed frame to fault in the buffers and wake the workers
+    renderFrame(view, variant, rowFn, scheduler, iterations);
+
+    double imbalanceSum = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<WorkerStats> stats = renderFrame(view, variant, rowFn, scheduler, iterations);
+        result.frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        double busyTotal = 0, busyMax = 0;
+        for (const WorkerStats& s : stats) {
+            busyTotal += s.busyMs;
+            busyMax = std::max(busyMax, s.busyMs);
+        }
+        if (busyTotal > 0)
+            imbalanceSum += busyMax / (busyTotal / stats.size()) - 1.0;
+    }
+    result.imbalance = imbalanceSum / frames;
+
+    for (int count : iterations) {
+        result.iterations += count;
+    }
+    return result;
+}
+
+// Nearest-rank percentile
+double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+int main(int argc, char* argv[]) {
+    int frames = argc > 1 ? std::max(1, std::stoi(argv[1])) : 7;
+    std::vector<Viewpoint> viewpoints = loadViewpoints();
+    std::vector<Variant> variants = makeVariants();
+
+    std::ostringstream json;
+    json.precision(6);
+    json << "{\n";
+    json << "  \"width\": " << WIDTH << ",\n";
+    json << "  \"height\": " << HEIGHT << ",\n";
+    json << "  \"frames\": " << frames << ",\n";
+    json << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    json << "  \"best_isa\": \"" << kernelIsaName(detectKernelIsa()) << "\",\n";
+    json << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    json << "  \"results\": [\n";
+
+    bool first = true;
+    for (const Variant& variant : variants) {
+        // One scheduler per variant; its workers stay up across viewpoints
+        TileScheduler scheduler(variant.threads, variant.tileSize);
+
+        for (const Viewpoint& view : viewpoints) {
+            std::cerr << variant.name << " / " << view.name << std::endl;
+            Result result = runVariant(view, variant, scheduler, frames);
+
+            double p50 = percentile(result.frameMs, 50);
+            double p99 = percentile(result.frameMs, 99);
+            double pixels = static_cast<double>(WIDTH) * HEIGHT;
+
+            json << (first ? "" : ",\n");
+            json << "    {\"viewpoint\": \"" << view.name << "\", \"variant\": \"" << variant.name << "\", "
+                 << "\"isa\": \"" << kernelIsaName(variant.isa) << "\", "
+                 << "\"interior_check\": " << (variant.options.interiorCheck ? "true" : "false") << ", "
+                 << "\"periodicity_check\": " << (variant.options.periodicityCheck ? "true" : "false") << ", "
+                 << "\"threads\": " << scheduler.getThreadCount() << ", \"tile_size\": " << variant.tileSize << ", "
+                 << "\"subdivision\": " << (variant.subdivision ? "true" : "false") << ", "
+                 << "\"max_iterations\": " << view.maxIterations << ", "
+                 << "\"p50_ms\": " << p50 << ", \"p99_ms\": " << p99 << ", "
+                 << "\"mpixels_per_s\": " << pixels / (p50 / 1000.0) / 1e6 << ", "
+                 << "\"iterations_per_s\": " << result.iterations / (p50 / 1000.0) << ", "
+                 << "\"imbalance\": " << result.imbalance << ", "
+                 << "\"checksum\": " << result.iterations << "}";
+            first = false;
+        }
+    }
+
+    json << "\n  ]\n}\n";
+    std::cout << json.str();
+
+    return 0;
+}
@@ -1,20 +1,49 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
 #include <iostream>
-#include <fstream>
-#include <complex>
+#include <string>
+#include <vector>
 
-// g++ -o mandelbrot_bmp mandelbrot_bmp.cpp && ./mandelbrot_bmp
+#include "fractal_kernel.hpp"
+#include "image_writer.hpp"
+#include "mandelbrot_antialias.hpp"
+#include "mandelbrot_kernel.hpp"
+#include "mandelbrot_palette.hpp"
+#include "tile_scheduler.hpp"
 
-const int WIDTH = 1920;
-const int HEIGHT = 1080;
-const int MAX_ITERATIONS = 5000;
+#define USE_DEEP_ZOOM 0
+#define USE_SUBDIVISION 0
+#define VERIFY_SUBDIVISION 0 // Also renders brute force and counts differing pixels
+#define USE_ANTIALIASING 0   // Supersamples the pixels on edges (not with USE_DEEP_ZOOM)
+
+#if USE_DEEP_ZOOM
+#include "mandelbrot_perturbation.hpp"
+#endif
+
+#if USE_SUBDIVISION
+#include "mandelbrot_subdivision.hpp"
+#endif
+
+// g++ -O2 -o mandelbrot_bmp mandelbrot_bmp.cpp -pthread && ./mandelbrot_bmp
+// Size, iterations and fractal are options, e.g. a cubic Julia set:
+// ./mandelbrot_bmp --size 3840x2160 --iterations 2000 --power 3 --julia 0.4 0.3 --radius 16
+// If USE_DEEP_ZOOM is set, zoom / pan can be given like in last_coordinates.txt (with as many digits as needed):
+// g++ -O2 -o mandelbrot_bmp mandelbrot_bmp.cpp -pthread -lgmpxx -lgmp && ./mandelbrot_bmp 468596 -1.39535 -0.113084
+
+const int BAND_HEIGHT = 16; // Rows per band handed to the writer
+const int AA_GRID = 4;       // Edge pixels get AA_GRID x AA_GRID samples
+const int AA_THRESHOLD = 24; // Color difference to a neighbor that makes an edge
 
 struct RGB {
     unsigned char r, g, b;
 };
+static_assert(sizeof(RGB) == 3, "RGB is written out as packed bytes");
 
-RGB getColor(int iterations) {
+RGB getColor(int iterations, int maxIterations) {
     RGB color;
-    double t = (double)iterations / MAX_ITERATIONS;
+    double t = (double)iterations / maxIterations;
 
     // Modify this color scheme as needed
     color.r = static_cast<unsigned char>(9 * (1 - t) * t * t * t * 255);
@@ -24,73 +53,230 @@ RGB getColor(int iterations) {
     return color;
 }
 
-int mandelbrot(double real, double imag) {
-    std::complex<double> point(real, imag);
-    std::complex<double> z(0, 0);
-    int iterations = 0;
+// Everything that can change without recompiling
+struct RenderOptions {
+    int width = 1920;
+    int height = 1080;
+    int maxIterations = 5000;
+    FractalSpec fractal;
 
-    while (abs(z) < 2 && iterations < MAX_ITERATIONS) {
-        z = z * z + point;
-        iterations++;
-    }
+    // Zoom and center for USE_DEEP_ZOOM
+    bool deep = false;
+    double deepZoom = 1.0;
+    std::string deepReal, deepImag;
+};
+
+// Positional arguments are only taken with USE_DEEP_ZOOM, as zoom real imag
+bool parseOptions(int argc, char* argv[], RenderOptions& options) {
+    std::vector<std::string> positional;
+    // std::stoi / std::stod throw on anything that is not a number
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            int left = argc - i - 1;
+            if (arg == "--size" && left >= 1) {
+                std::string size = argv[++i];
+                size_t x = size.find('x');
+                if (x == std::string::npos)
+                    return false;
+                options.width = std::stoi(size.substr(0, x));
+                options.height = std::stoi(size.substr(x + 1));
+            } else if (arg == "--iterations" && left >= 1) {
+                options.maxIterations = std::stoi(argv[++i]);
+            } else if (arg == "--power" && left >= 1) {
+                options.fractal.power = std::stoi(argv[++i]);
+            } else if (arg == "--julia" && left >= 2) {
+                options.fractal.julia = true;
+                options.fractal.juliaReal = std::stod(argv[++i]);
+                options.fractal.juliaImag = std::stod(argv[++i]);
+            } else if (arg == "--radius" && left >= 1) {
+                options.fractal.escapeRadius = std::stoi(argv[++i]);
+            } else if (arg == "--square") {
+                options.fractal.bailout = Bailout::Square;
+            } else if (arg.compare(0, 2, "--") == 0) {
+                return false;
+            } else {
+                positional.push_back(arg);
+            }
+        }
 
-    return iterations;
+        if (!positional.empty()) {
+            if (!USE_DEEP_ZOOM || positional.size() != 3)
+                return false;
+            options.deep = true;
+            options.deepZoom = std::stod(positional[0]);
+            options.deepReal = positional[1];
+            options.deepImag = positional[2];
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return options.width > 0 && options.height > 0 && options.maxIterations > 0;
 }
 
-void saveBitmap(const std::string& filename, const RGB* colors) {
-    std::ofstream file(filename, std::ios::out | std::ios::binary);
-    if (!file) {
-        std::cerr << "Could not open file for writing." << std::endl;
-        return;
+// Iterates count points given in pixel coordinates (for anti-aliasing)
+using SampleFn = std::function<void(const double* x, const double* y, int count, int* iterations)>;
+
+// Renders full-width bands of rows on the scheduler and streams each band
+// to the writer as soon as it is colored, so only a few bands are in memory.
+// With sample set, edge pixels are supersampled on the same worker; a band
+// then also iterates the row above and below it to find its edges.
+template <typename RowFn>
+std::vector<WorkerStats> renderToFile(StreamingImageWriter& writer, TileScheduler& scheduler, const Palette<RGB>& palette, int width, int height,
+                                      const RowFn& iterateRow, const SampleFn& sample = nullptr) {
+    std::vector<Tile> bands;
+    for (int y = 0; y < height; y += BAND_HEIGHT) {
+        bands.push_back({0, y, width, std::min(y + BAND_HEIGHT, height)});
     }
 
-    unsigned char fileHeader[14] = {'B', 'M', 0, 0, 0, 0, 0, 0, 0, 0, 54, 0, 0, 0};
-    unsigned char infoHeader[40] = {40, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 24, 0};
-
-    int fileSize = 54 + 3 * WIDTH * HEIGHT;
-    fileHeader[2] = (unsigned char)(fileSize);
-    fileHeader[3] = (unsigned char)(fileSize >> 8);
-    fileHeader[4] = (unsigned char)(fileSize >> 16);
-    fileHeader[5] = (unsigned char)(fileSize >> 24);
-
-    infoHeader[4] = (unsigned char)(WIDTH);
-    infoHeader[5] = (unsigned char)(WIDTH >> 8);
-    infoHeader[6] = (unsigned char)(WIDTH >> 16);
-    infoHeader[7] = (unsigned char)(WIDTH >> 24);
-
-    infoHeader[8] = (unsigned char)(HEIGHT);
-    infoHeader[9] = (unsigned char)(HEIGHT >> 8);
-    infoHeader[10] = (unsigned char)(HEIGHT >> 16);
-    infoHeader[11] = (unsigned char)(HEIGHT >> 24);
-
-    file.write(reinterpret_cast<char*>(fileHeader), 14);
-    file.write(reinterpret_cast<char*>(infoHeader), 40);
-
-    for (int y = 0; y < HEIGHT; y++) {
-        for (int x = 0; x < WIDTH; x++) {
-            RGB color = colors[y * WIDTH + x];
-            unsigned char pixel[3] = {color.b, color.g, color.r};  // BMP uses BGR format
-            file.write(reinterpret_cast<char*>(pixel), 3);
+    EdgeAntialiaser<RGB> antialiaser(AA_GRID, AA_THRESHOLD);
+    std::atomic<long long> antialiased{0};
+
+    auto stats = scheduler.run(bands, [&](const Tile& band) {
+        thread_local std::vector<int> values;
+        thread_local std::vector<RGB> colors;
+        int r0 = sample ? std::max(0, band.y0 - 1) : band.y0;
+        int r1 = sample ? std::min(height, band.y1 + 1) : band.y1;
+        values.resize(width);
+        colors.resize(static_cast<size_t>(width) * (r1 - r0));
+
+        for (int y = r0; y < r1; y++) {
+            iterateRow(y, 0, width, values.data());
+            palette.colorize(values.data(), width, &colors[static_cast<size_t>(y - r0) * width]);
         }
+        if (sample)
+            antialiased += antialiaser.apply(colors.data(), width, r0, r1, band.y0, band.y1, palette, sample);
+        writer.writeRows(band.y0, band.y1 - band.y0, reinterpret_cast<const unsigned char*>(&colors[static_cast<size_t>(band.y0 - r0) * width]));
+    });
+
+    if (sample) {
+        std::cout << "Antialiased " << antialiased << " of " << width * height << " pixels (" << 100.0 * antialiased / (width * height) << "%) with up to "
+                  << antialiaser.getSamplesPerPixel() << " samples each" << std::endl;
     }
+    return stats;
+}
+
+#if USE_DEEP_ZOOM
+void renderDeep(StreamingImageWriter& writer, const Palette<RGB>& palette, TileScheduler& scheduler, const RenderOptions& options, double zoom,
+                const std::string& real, const std::string& imag) {
+    int width = options.width, height = options.height;
+    DeepView view{real, imag, 1.0 / (0.5 * zoom * width), 1.0 / (0.5 * zoom * height), width, height};
+    PerturbationFrame frame(view, options.maxIterations);
 
-    file.close();
+    auto stats = renderToFile(writer, scheduler, palette, width, height, [&](int y, int x0, int x1, int* iterations) {
+        frame.iterateRow(y, x0, x1, iterations);
+    });
+    printWorkerStats(stats);
+
+    std::cout << "Reference orbit: " << frame.getReferenceLength() << " iterations at " << frame.getPrecisionBits()
+              << " bits, " << frame.getSkippedIterations() << " skipped by series approximation, "
+              << frame.getRebaseCount() << " rebases" << std::endl;
 }
+#endif
 
-int main() {
-    RGB colors[WIDTH * HEIGHT];
+int main(int argc, char* argv[]) {
+    RenderOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--size WxH] [--iterations n] [--power d] [--julia real imag] [--radius r] [--square]"
+                  << (USE_DEEP_ZOOM ? " [zoom real imag]" : "") << std::endl;
+        return 1;
+    }
+    const int width = options.width;
+    const int height = options.height;
+    const int maxIterations = options.maxIterations;
 
-    for (int y = 0; y < HEIGHT; y++) {
-        for (int x = 0; x < WIDTH; x++) {
-            double real = (x - WIDTH / 2.0) * 4.0 / WIDTH;
-            double imag = (y - HEIGHT / 2.0) * 4.0 / WIDTH;
-            int value = mandelbrot(real, imag);
-            colors[y * WIDTH + x] = getColor(value);
+    FractalKernel<double> kernel(options.fractal);
+    if (!kernel.isValid()) {
+        std::cerr << "No kernel for " << options.fractal.name() << "; see FractalPowers and FractalRadii in fractal_kernel.hpp" << std::endl;
+        return 1;
+    }
+
+    TileScheduler scheduler;
+    Palette<RGB> palette(maxIterations, [&](int n) { return getColor(n, maxIterations); });
+    StreamingImageWriter writer("mandelbrot.bmp", width, height);
+    if (!writer.isGood())
+        return 1;
+
+#if USE_DEEP_ZOOM
+    if (options.deep) {
+        if (!options.fractal.isClassic()) {
+            std::cerr << "Deep zoom only renders the classic Mandelbrot set" << std::endl;
+            return 1;
         }
+        renderDeep(writer, palette, scheduler, options, options.deepZoom, options.deepReal, options.deepImag);
+        std::cout << "Mandelbrot set image saved as mandelbrot.bmp" << std::endl;
+        return 0;
     }
+#endif
+
+    std::vector<double> real(width);
+
+    for (int x = 0; x < width; x++) {
+        real[x] = (x - width / 2.0) * 4.0 / width;
+    }
+
+    auto iterateRow = [&](int y, int x0, int x1, int* iterations) {
+        double imag = (y - height / 2.0) * 4.0 / width;
+        kernel.iterateRow(real.data() + x0, imag, x1 - x0, maxIterations, iterations);
+    };
+
+    SampleFn sample;
+#if USE_ANTIALIASING
+    sample = [&](const double* x, const double* y, int count, int* iterations) {
+        thread_local std::vector<double> sampleReal, sampleImag;
+        sampleReal.resize(count);
+        sampleImag.resize(count);
+        for (int i = 0; i < count; i++) {
+            sampleReal[i] = (x[i] - width / 2.0) * 4.0 / width;
+            sampleImag[i] = (y[i] - height / 2.0) * 4.0 / width;
+        }
+        kernel.iteratePoints(sampleReal.data(), sampleImag.data(), count, maxIterations, iterations);
+    };
+#endif
 
-    saveBitmap("mandelbrot.bmp", colors);
-    std::cout << "Mandelbrot set image saved as mandelbrot.bmp" << std::endl;
+#if USE_SUBDIVISION
+    auto iterateColumn = [&](int x, int y0, int y1, int* iterations) {
+        std::vector<double> columnReal(y1 - y0, real[x]), columnImag(y1 - y0);
+        for (int y = y0; y < y1; y++) {
+            columnImag[y - y0] = (y - height / 2.0) * 4.0 / width;
+        }
+        kernel.iteratePoints(columnReal.data(), columnImag.data(), y1 - y0, maxIterations, iterations);
+    };
+#endif
+
+#if USE_SUBDIVISION
+    std::vector<int> iterations(width * height);
+    long long iterated = renderSubdivided(scheduler, width, height, iterations.data(), iterateRow, iterateColumn);
+    std::cout << "Subdivision iterated " << iterated << " of " << width * height << " pixels" << std::endl;
+
+#if VERIFY_SUBDIVISION
+    std::vector<int> bruteForce(width * height);
+    scheduler.run(width, height, [&](const Tile& tile) {
+        for (int y = tile.y0; y < tile.y1; y++) {
+            iterateRow(y, tile.x0, tile.x1, &bruteForce[y * width + tile.x0]);
+        }
+    });
+    long long differing = 0;
+    for (int i = 0; i < width * height; i++) {
+        differing += iterations[i] != bruteForce[i];
+    }
+    std::cout << differing << " pixels differ from brute force" << std::endl;
+#endif
+
+    // Subdivision needs the whole frame of counts; only coloring streams
+    renderToFile(writer, scheduler, palette, width, height, [&](int y, int x0, int x1, int* values) {
+        std::copy(&iterations[y * width + x0], &iterations[y * width + x1], values);
+    }, sample);
+#else
+    auto stats = renderToFile(writer, scheduler, palette, width, height, iterateRow, sample);
+    printWorkerStats(stats);
+#endif
+
+    if (!writer.isGood()) {
+        std::cerr << "Could not write mandelbrot.bmp" << std::endl;
+        return 1;
+    }
+    std::cout << options.fractal.name() << " image saved as mandelbrot.bmp" << std::endl;
 
     return 0;
 }
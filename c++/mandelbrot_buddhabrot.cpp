@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "image_writer.hpp"
+#include "mandelbrot_kernel.hpp"
+#include "tile_scheduler.hpp"
+
+// g++ -O2 -o mandelbrot_buddhabrot mandelbrot_buddhabrot.cpp -pthread && ./mandelbrot_buddhabrot
+// Millions of samples and the image size can be given, e.g. two billion samples at 4K:
+// g++ -O2 -o mandelbrot_buddhabrot mandelbrot_buddhabrot.cpp -pthread && ./mandelbrot_buddhabrot 2000 3840 2160
+
+// Orbit density instead of escape time: every c whose orbit escapes adds
+// each point of its orbit to a histogram. The Nebulabrot does that for three
+// iteration caps at once, one per color channel (the red channel shows the
+// orbits escaping within 5000 iterations, blue only those within 50).
+#define USE_NEBULABROT 1
+
+#if USE_NEBULABROT
+const int CHANNELS = 3;
+const int CHANNEL_ITERATIONS[CHANNELS] = {5000, 500, 50}; // Red, green, blue
+#else
+const int CHANNELS = 1;
+const int CHANNEL_ITERATIONS[CHANNELS] = {2000};
+#endif
+const int MAX_ITERATIONS = *std::max_element(CHANNEL_ITERATIONS, CHANNEL_ITERATIONS + CHANNELS);
+
+const int WIDTH = 1920;
+const int HEIGHT = 1080;
+const double CENTER_REAL = -0.4;
+const double VIEW_HEIGHT = 2.8; // Of the complex plane, the width follows from the image
+
+const long long SAMPLES = 200'000'000;
+const long long CHECKPOINT_SAMPLES = 25'000'000; // Between merges and image updates
+const int BATCH_SAMPLES = 16384;                 // One scheduler tile
+
+// c is sampled from real -2 .. 2, imag 0 .. 2 (the lower half is the mirror
+// image) in GRID_WIDTH x GRID_HEIGHT cells, each picked in proportion to how
+// much its orbits added to the picture in a pilot run
+const int GRID_WIDTH = 256;
+const int GRID_HEIGHT = 128;
+const int PILOT_SAMPLES = 32;      // Per cell
+const double UNIFORM_SHARE = 0.1;  // Of the samples spread evenly, so no cell is left out
+
+struct RGB {
+    unsigned char r, g, b;
+};
+static_assert(sizeof(RGB) == 3, "RGB is written out as packed bytes");
+
+// Maps orbit points to the pixels of the image
+struct DensityView {
+    int width;
+    int height;
+    double left;
+    double top;
+    double pixelsPerUnit;
+
+    DensityView(int width, int height) : width(width), height(height), pixelsPerUnit(height / VIEW_HEIGHT) {
+        left = CENTER_REAL - 0.5 * width / pixelsPerUnit;
+        top = -0.5 * height / pixelsPerUnit;
+    }
+
+    // -1 if z is outside of the picture
+    long long pixelOf(double real, double imag) const {
+        double x = (real - left) * pixelsPerUnit;
+        double y = (imag - top) * pixelsPerUnit;
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return -1;
+        return static_cast<long long>(y) * width + static_cast<long long>(x);
+    }
+};
+
+// Sampling density over the cells of the c grid, as a cumulative table for
+// drawing cells and the weight that makes up for a cell being drawn more or
+// less often than under uniform sampling
+struct ImportanceMap {
+    std::vector<double> cumulative;
+    std::vector<float> weight;
+
+    static double cellWidth() { return 4.0 / GRID_WIDTH; }
+    static double cellHeight() { return 2.0 / GRID_HEIGHT; }
+
+    int drawCell(double u) const {
+        int cell = static_cast<int>(std::upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin());
+        return std::min(cell, GRID_WIDTH * GRID_HEIGHT - 1);
+    }
+};
+
+// Number of the orbit points z2 .. z(iterations) of c (and of conj(c)) that
+// land in the view, as addOrbit() plots them
+int orbitPointsInView(const DensityView& view, double cr, double ci, int iterations) {
+    double zr = cr, zi = ci;
+    int inView = 0;
+    for (int n = 1; n < iterations; n++) {
+        double zr2 = zr * zr;
+        double zi2 = zi * zi;
+        zi = 2 * zr * zi + ci;
+        zr = zr2 - zi2 + cr;
+        inView += (view.pixelOf(zr, zi) >= 0) + (view.pixelOf(zr, -zi) >= 0);
+    }
+    return inView;
+}
+
+// Escape counts of count points with the largest cap. The cardioid and bulb
+// are rejected by the caller, so the kernel only checks for cycles.
+//
+// A SIMD lane that is done idles until the slowest lane of its vector is, so
+// a batch of random c would run at about scalar speed. Instead the points
+// go through rising caps, and each stage only iterates the ones still
+// inside after the one before; the few that need thousands of iterations
+// then share their vectors with each other.
+void escapeCounts(const double* real, const double* imag, int count, int* iterations) {
+    static const MandelbrotRowFn<double> rowFn = selectMandelbrotRow<double>();
+    const int STAGE_ITERATIONS[] = {64, 512};
+    const int STAGES = sizeof(STAGE_ITERATIONS) / sizeof(STAGE_ITERATIONS[0]);
+    KernelOptions options;
+    options.interiorCheck = false;
+    options.periodicityCheck = true;
+
+    thread_local std::vector<double> stageReal, stageImag;
+    thread_local std::vector<int> stageIndex, stageIterations;
+    stageReal.assign(real, real + count);
+    stageImag.assign(imag, imag + count);
+    stageIndex.resize(count);
+    for (int i = 0; i < count; i++) {
+        stageIndex[i] = i;
+    }
+
+    for (int stage = 0; stage <= STAGES && !stageIndex.empty(); stage++) {
+        int cap = stage < STAGES ? std::min(STAGE_ITERATIONS[stage], MAX_ITERATIONS) : MAX_ITERATIONS;
+        int stageCount = static_cast<int>(stageIndex.size());
+        stageIterations.resize(stageCount);
+        mandelbrotPoints(rowFn, stageReal.data(), stageImag.data(), stageCount, cap, stageIterations.data(), options);
+
+        // Points still inside go on to the next stage, from z = 0 again
+        int inside = 0;
+        for (int i = 0; i < stageCount; i++) {
+            int index = stageIndex[i];
+            iterations[index] = stageIterations[i] < cap ? stageIterations[i] : MAX_ITERATIONS;
+            if (stageIterations[i] >= cap && cap < MAX_ITERATIONS) {
+                stageReal[inside] = stageReal[i];
+                stageImag[inside] = stageImag[i];
+                stageIndex[inside] = index;
+                inside++;
+            }
+        }
+        stageReal.resize(inside);
+        stageImag.resize(inside);
+        stageIndex.resize(inside);
+    }
+}
+
+// Runs PILOT_SAMPLES uniform samples per cell and weights the cells by the
+// orbit points they put into the picture
+ImportanceMap buildImportanceMap(TileScheduler& scheduler, const DensityView& view) {
+    const int cells = GRID_WIDTH * GRID_HEIGHT;
+    std::vector<double> value(cells, 0.0);
+
+    std::vector<Tile> rows;
+    for (int y = 0; y < GRID_HEIGHT; y++) {
+        rows.push_back({0, y, GRID_WIDTH, y + 1});
+    }
+    scheduler.run(rows, [&](const Tile& row) {
+        std::vector<double> real(PILOT_SAMPLES), imag(PILOT_SAMPLES);
+        std::vector<int> iterations(PILOT_SAMPLES);
+        for (int x = row.x0; x < row.x1; x++) {
+            int cell = row.y0 * GRID_WIDTH + x;
+            std::mt19937_64 rng(0x9e3779b97f4a7c15ull * (cell + 1));
+            std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+            int count = 0;
+            for (int s = 0; s < PILOT_SAMPLES; s++) {
+                double cr = -2.0 + (x + unit(rng)) * ImportanceMap::cellWidth();
+                double ci = (row.y0 + unit(rng)) * ImportanceMap::cellHeight();
+                if (inCardioidOrBulb(cr, ci))
+                    continue;
+                real[count] = cr;
+                imag[count] = ci;
+                count++;
+            }
+            escapeCounts(real.data(), imag.data(), count, iterations.data());
+
+            long long inView = 0;
+            for (int s = 0; s < count; s++) {
+                if (iterations[s] < MAX_ITERATIONS)
+                    inView += orbitPointsInView(view, real[s], imag[s], iterations[s]);
+            }
+            value[cell] = static_cast<double>(inView) / PILOT_SAMPLES;
+        }
+    });
+
+    double total = 0;
+    for (double v : value) {
+        total += v;
+    }
+
+    ImportanceMap map;
+    map.cumulative.resize(cells);
+    map.weight.resize(cells);
+    double sum = 0;
+    for (int cell = 0; cell < cells; cell++) {
+        double p = total > 0 ? (1 - UNIFORM_SHARE) * value[cell] / total + UNIFORM_SHARE / cells : 1.0 / cells;
+        sum += p;
+        map.cumulative[cell] = sum;
+        map.weight[cell] = static_cast<float>(1.0 / (cells * p));
+    }
+    for (double& c : map.cumulative) {
+        c /= sum;
+    }
+    return map;
+}
+
+// Per-worker density, CHANNELS floats per pixel (25 MB per worker at
+// 1920x1080). Workers only ever add to their own, so no atomics are needed
+// while sampling.
+struct Histogram {
+    std::vector<float> density;
+    long long orbits = 0;
+    long long rejected = 0;
+
+    explicit Histogram(size_t pixels) : density(pixels * CHANNELS, 0.0f) {}
+};
+
+class BuddhabrotRenderer {
+public:
+    BuddhabrotRenderer(TileScheduler& scheduler, int width, int height)
+        : scheduler(scheduler), view(width, height), total(static_cast<size_t>(width) * height * CHANNELS, 0.0) {
+        for (unsigned i = 0; i < scheduler.getThreadCount(); i++) {
+            histograms.emplace_back(new Histogram(static_cast<size_t>(width) * height));
+        }
+        importance = buildImportanceMap(scheduler, view);
+    }
+
+    // Samples count c values (in whole batches) into the worker histograms
+    // and merges those into the total
+    void sample(long long count) {
+        std::vector<Tile> batches;
+        long long batchCount = (count + BATCH_SAMPLES - 1) / BATCH_SAMPLES;
+        for (long long b = 0; b < batchCount; b++) {
+            int index = static_cast<int>(nextBatch + b);
+            batches.push_back({index, 0, index + 1, 1});
+        }
+        nextBatch += batchCount;
+
+        scheduler.run(batches, [&](const Tile& batch) { sampleBatch(batch.x0); });
+        samples += batchCount * BATCH_SAMPLES;
+        reduce();
+    }
+
+    long long getSamples() const { return samples; }
+    long long getOrbits() const { return orbits; }
+    long long getRejected() const { return rejected; }
+
+    // Maps each channel so its 99.9th percentile of the lit pixels is full
+    // brightness, with a square root to bring out the faint orbits
+    std::vector<RGB> toImage() const {
+        size_t pixels = static_cast<size_t>(view.width) * view.height;
+        double scale[CHANNELS];
+        for (int c = 0; c < CHANNELS; c++) {
+            std::vector<double> lit;
+            for (size_t i = 0; i < pixels; i++) {
+                if (total[i * CHANNELS + c] > 0)
+                    lit.push_back(total[i * CHANNELS + c]);
+            }
+            double reference = 1;
+            if (!lit.empty()) {
+                auto nth = lit.begin() + static_cast<long long>((lit.size() - 1) * 0.999);
+                std::nth_element(lit.begin(), nth, lit.end());
+                reference = *nth;
+            }
+            scale[c] = 1.0 / reference;
+        }
+
+        std::vector<RGB> image(pixels);
+        for (size_t i = 0; i < pixels; i++) {
+            unsigned char level[CHANNELS];
+            for (int c = 0; c < CHANNELS; c++) {
+                level[c] = static_cast<unsigned char>(255 * std::min(1.0, std::sqrt(total[i * CHANNELS + c] * scale[c])));
+            }
+            // A single channel is grey
+            image[i] = {level[0], level[CHANNELS > 1 ? 1 : 0], level[CHANNELS > 2 ? 2 : 0]};
+        }
+        return image;
+    }
+
+private:
+    TileScheduler& scheduler;
+    DensityView view;
+    ImportanceMap importance;
+    std::vector<std::unique_ptr<Histogram>> histograms;
+    std::vector<double> total;
+    std::atomic<unsigned> nextSlot{0};
+    long long nextBatch = 0;
+    long long samples = 0;
+    long long orbits = 0;
+    long long rejected = 0;
+
+    // The scheduler keeps its threads, so each worker keeps the histogram it
+    // was given on its first batch
+    Histogram& workerHistogram() {
+        thread_local unsigned slot = nextSlot++;
+        return *histograms[slot];
+    }
+
+    void sampleBatch(int batch) {
+        Histogram& histogram = workerHistogram();
+        thread_local std::vector<double> real, imag;
+        thread_local std::vector<float> weight;
+        thread_local std::vector<int> iterations;
+        real.resize(BATCH_SAMPLES);
+        imag.resize(BATCH_SAMPLES);
+        weight.resize(BATCH_SAMPLES);
+        iterations.resize(BATCH_SAMPLES);
+
+        // Seeded by batch, so the samples do not depend on the thread count
+        std::mt19937_64 rng(0xd1b54a32d192ed03ull * (batch + 1));
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+        int count = 0;
+        for (int s = 0; s < BATCH_SAMPLES; s++) {
+            int cell = importance.drawCell(unit(rng));
+            double cr = -2.0 + (cell % GRID_WIDTH + unit(rng)) * ImportanceMap::cellWidth();
+            double ci = (cell / GRID_WIDTH + unit(rng)) * ImportanceMap::cellHeight();
+            // Never escapes, so never adds anything
+            if (inCardioidOrBulb(cr, ci)) {
+                histogram.rejected++;
+                continue;
+            }
+            real[count] = cr;
+            imag[count] = ci;
+            weight[count] = importance.weight[cell];
+            count++;
+        }
+
+        escapeCounts(real.data(), imag.data(), count, iterations.data());
+        for (int s = 0; s < count; s++) {
+            if (iterations[s] < MAX_ITERATIONS)
+                addOrbit(histogram, real[s], imag[s], iterations[s], weight[s]);
+        }
+    }
+
+    // Adds the orbit of c and of its mirror image conj(c) to the channels
+    // whose cap it escaped within
+    void addOrbit(Histogram& histogram, double cr, double ci, int escapedAt, float weight) {
+        float channelWeight[CHANNELS];
+        for (int c = 0; c < CHANNELS; c++) {
+            channelWeight[c] = escapedAt < CHANNEL_ITERATIONS[c] ? weight : 0.0f;
+        }
+        histogram.orbits++;
+
+        // z1 = c is left out: it is just the sample, and would cover the
+        // sampled area with an even haze
+        float* density = histogram.density.data();
+        double zr = cr, zi = ci;
+        for (int n = 1; n < escapedAt; n++) {
+            double zr2 = zr * zr;
+            double zi2 = zi * zi;
+            zi = 2 * zr * zi + ci;
+            zr = zr2 - zi2 + cr;
+
+            long long upper = view.pixelOf(zr, zi);
+            long long lower = view.pixelOf(zr, -zi);
+            for (int c = 0; c < CHANNELS; c++) {
+                if (upper >= 0)
+                    density[upper * CHANNELS + c] += channelWeight[c];
+                if (lower >= 0)
+                    density[lower * CHANNELS + c] += channelWeight[c];
+            }
+        }
+    }
+
+    // Sums the worker histograms into the total as a tree: in each round
+    // histogram i takes in histogram i + stride, for i a multiple of
+    // 2 * stride, and the pairs are cut into bands so all cores add in every
+    // round. The last round adds histogram 0 into the total. Every histogram
+    // that was added in is cleared for the next checkpoint.
+    void reduce() {
+        struct Job {
+            float* into;
+            float* from;
+            size_t begin, end;
+        };
+        const size_t BAND = 1 << 16;
+        size_t size = histograms[0]->density.size();
+
+        auto runJobs = [&](const std::vector<Job>& jobs, bool toTotal) {
+            std::vector<Tile> tiles;
+            for (size_t j = 0; j < jobs.size(); j++) {
+                tiles.push_back({static_cast<int>(j), 0, static_cast<int>(j) + 1, 1});
+            }
+            scheduler.run(tiles, [&](const Tile& tile) {
+                const Job& job = jobs[tile.x0];
+                for (size_t i = job.begin; i < job.end; i++) {
+                    if (toTotal)
+                        total[i] += job.from[i];
+                    else
+                        job.into[i] += job.from[i];
+                    job.from[i] = 0.0f;
+                }
+            });
+        };
+
+        for (size_t stride = 1; stride < histograms.size(); stride *= 2) {
+            std::vector<Job> jobs;
+            for (size_t i = 0; i + stride < histograms.size(); i += 2 * stride) {
+                for (size_t begin = 0; begin < size; begin += BAND) {
+                    jobs.push_back({histograms[i]->density.data(), histograms[i + stride]->density.data(), begin, std::min(size, begin + BAND)});
+                }
+            }
+            runJobs(jobs, false);
+        }
+
+        std::vector<Job> jobs;
+        for (size_t begin = 0; begin < size; begin += BAND) {
+            jobs.push_back({nullptr, histograms[0]->density.data(), begin, std::min(size, begin + BAND)});
+        }
+        runJobs(jobs, true);
+
+        for (auto& histogram : histograms) {
+            orbits += histogram->orbits;
+            rejected += histogram->rejected;
+            histogram->orbits = 0;
+            histogram->rejected = 0;
+        }
+    }
+};
+
+bool writeImage(const std::string& filename, int width, int height, const std::vector<RGB>& image) {
+    StreamingImageWriter writer(filename, width, height);
+    if (!writer.isGood())
+        return false;
+    writer.writeRows(0, height, reinterpret_cast<const unsigned char*>(image.data()));
+    return writer.isGood();
+}
+
+int main(int argc, char* argv[]) {
+    long long samples = argc >= 2 ? static_cast<long long>(std::stod(argv[1]) * 1e6) : SAMPLES;
+    int width = argc >= 4 ? std::stoi(argv[2]) : WIDTH;
+    int height = argc >= 4 ? std::stoi(argv[3]) : HEIGHT;
+
+    TileScheduler scheduler;
+    auto start = std::chrono::steady_clock::now();
+    BuddhabrotRenderer renderer(scheduler, width, height);
+    double pilotSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Importance map of " << GRID_WIDTH << "x" << GRID_HEIGHT << " cells in " << pilotSeconds << " s" << std::endl;
+
+    // The image is rewritten at every checkpoint, so a long run can be
+    // watched and stopped once it looks smooth enough
+    while (renderer.getSamples() < samples) {
+        renderer.sample(std::min(CHECKPOINT_SAMPLES, samples - renderer.getSamples()));
+        if (!writeImage("buddhabrot.bmp", width, height, renderer.toImage())) {
+            std::cerr << "Could not write buddhabrot.bmp" << std::endl;
+            return 1;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << renderer.getSamples() / 1e6 << " M samples, " << renderer.getOrbits() / 1e6 << " M orbits plotted, "
+                  << 100.0 * renderer.getRejected() / renderer.getSamples() << "% rejected by the cardioid / bulb test, "
+                  << renderer.getSamples() / 1e6 / seconds << " M samples/s" << std::endl;
+    }
+
+    std::cout << (USE_NEBULABROT ? "Nebulabrot" : "Buddhabrot") << " image saved as buddhabrot.bmp" << std::endl;
+    return 0;
+}
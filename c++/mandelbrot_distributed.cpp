@@ -0,0 +1,703 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "image_writer.hpp"
+#include "mandelbrot_palette.hpp"
+#include "mandelbrot_viewport.hpp"
+#include "tile_scheduler.hpp"
+
+// Distributed renderer: one coordinator, any number of worker processes
+// (POSIX only).
+//
+// The coordinator cuts the image into bands of BAND_HEIGHT full rows, hands
+// them to the workers connected over a Unix-domain or TCP socket, and writes
+// every band it gets back straight into the streaming BMP / PPM writer, so
+// it never holds more than the bands in flight. Each worker renders a band
+// on all of its cores with the usual tile scheduler and sends back the
+// colored rows.
+//
+// Every worker has PIPELINE_DEPTH bands queued, so it starts on the next one
+// while the coordinator is still receiving the last. A worker that
+// disconnects, or returns nothing for WORKER_TIMEOUT_MS, is dropped and its
+// bands are handed out again. Near the end, when nothing is pending, idle
+// workers get a backup copy of the bands held by a worker that is much slower
+// than the median band; whichever copy arrives first is written.
+//
+// Addresses are unix:/path or host:port. Workers may start before the
+// coordinator; they retry for a while, and they exit when it closes the
+// connection.
+//
+// g++ -O2 -o mandelbrot_distributed mandelbrot_distributed.cpp -lgmpxx -lgmp -pthread
+// On one machine, with 4 worker processes over a Unix socket:
+// ./mandelbrot_distributed local 4
+// Across machines; size, then zoom / pan like in last_coordinates.txt:
+// ./mandelbrot_distributed coordinator 0.0.0.0:9000 16384 16384 1 -0.5 0
+// ./mandelbrot_distributed worker render-host:9000
+
+const int BAND_HEIGHT = 32;
+const int MAX_ITERATIONS = 5000;
+const int PIPELINE_DEPTH = 2;              // Bands queued per worker
+const double BACKUP_FACTOR = 4.0;          // Band time over the median that gets a backup copy
+const double MIN_BACKUP_MS = 1000;         // but never sooner than this
+const double WORKER_TIMEOUT_MS = 60000;    // Without a result while holding bands
+const int CONNECT_ATTEMPTS = 100;          // 100 ms apart
+const size_t MAX_MESSAGE = 256u << 20;
+const char* OUTPUT_FILE = "mandelbrot_distributed.bmp";
+
+struct RGB {
+    unsigned char r, g, b;
+};
+static_assert(sizeof(RGB) == 3, "RGB is sent as packed bytes");
+
+RGB getColor(int iterations) {
+    RGB color;
+    double t = (double)iterations / MAX_ITERATIONS;
+
+    // Modify this color scheme as needed
+    color.r = static_cast<unsigned char>(9 * (1 - t) * t * t * t * 255);
+    color.g = static_cast<unsigned char>(15 * (1 - t) * (1 - t) * t * t * 255);
+    color.b = static_cast<unsigned char>(8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255);
+
+    return color;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsBetween(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// What to render; sent to every worker as text when it connects
+struct RenderJob {
+    int width = 8192;
+    int height = 8192;
+    double zoom = 1.0;
+    std::string real = "-0.5";
+    std::string imag = "0";
+
+    int getBandCount() const { return (height + BAND_HEIGHT - 1) / BAND_HEIGHT; }
+    int bandStart(int band) const { return band * BAND_HEIGHT; }
+    int bandEnd(int band) const { return std::min(height, (band + 1) * BAND_HEIGHT); }
+
+    std::string serialize() const {
+        std::ostringstream out;
+        out.precision(17);
+        out << width << " " << height << " " << BAND_HEIGHT << " " << MAX_ITERATIONS << " " << zoom << " " << real << " " << imag;
+        return out.str();
+    }
+
+    // Fails if the coordinator was built with other band or iteration
+    // settings
+    bool parse(const std::string& text) {
+        std::istringstream in(text);
+        int bandHeight, maxIterations;
+        return static_cast<bool>(in >> width >> height >> bandHeight >> maxIterations >> zoom >> real >> imag) && bandHeight == BAND_HEIGHT &&
+               maxIterations == MAX_ITERATIONS && width > 0 && height > 0;
+    }
+};
+
+// Messages are a header of three little-endian 32-bit words (type, band,
+// payload size) and the payload
+enum MessageType : uint32_t { HELLO = 1, JOB, BAND, RESULT };
+
+struct Message {
+    uint32_t type = 0;
+    uint32_t band = 0;
+    std::string payload;
+};
+
+const size_t HEADER_SIZE = 12;
+
+void putWord(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+uint32_t getWord(const std::string& in, size_t offset) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= static_cast<uint32_t>(static_cast<unsigned char>(in[offset + i])) << (8 * i);
+    }
+    return value;
+}
+
+std::string encodeMessage(uint32_t type, uint32_t band, const char* payload = nullptr, size_t size = 0) {
+    std::string out;
+    out.reserve(HEADER_SIZE + size);
+    putWord(out, type);
+    putWord(out, band);
+    putWord(out, static_cast<uint32_t>(size));
+    if (size > 0)
+        out.append(payload, size);
+    return out;
+}
+
+// Takes the first message out of buffer if it is complete. Returns -1 for
+// a malformed message.
+int takeMessage(std::string& buffer, Message& message) {
+    if (buffer.size() < HEADER_SIZE)
+        return 0;
+    size_t size = getWord(buffer, 8);
+    if (size > MAX_MESSAGE)
+        return -1;
+    if (buffer.size() < HEADER_SIZE + size)
+        return 0;
+    message.type = getWord(buffer, 0);
+    message.band = getWord(buffer, 4);
+    message.payload.assign(buffer, HEADER_SIZE, size);
+    buffer.erase(0, HEADER_SIZE + size);
+    return 1;
+}
+
+// unix:/path or host:port; an empty host or * listens on all interfaces
+bool resolveAddress(const std::string& address, bool listening, sockaddr_storage& storage, socklen_t& length) {
+    std::memset(&storage, 0, sizeof(storage));
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un* local = reinterpret_cast<sockaddr_un*>(&storage);
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(local->sun_path))
+            return false;
+        local->sun_family = AF_UNIX;
+        std::strcpy(local->sun_path, path.c_str());
+        length = sizeof(sockaddr_un);
+        return true;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+    std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.empty() || host == "*" ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0 || !result)
+        return false;
+    std::memcpy(&storage, result->ai_addr, result->ai_addrlen);
+    length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+int listenOn(const std::string& address) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveAddress(address, true, storage, length))
+        return -1;
+    if (storage.ss_family == AF_UNIX)
+        unlink(reinterpret_cast<sockaddr_un*>(&storage)->sun_path);
+
+    int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&storage), length) < 0 || listen(fd, SOMAXCONN) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connectTo(const std::string& address) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveAddress(address, false, storage, length))
+        return -1;
+    int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&storage), length) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (storage.ss_family != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Blocking read of the next message; false when the connection is closed
+bool receiveMessage(int fd, std::string& buffer, Message& message) {
+    char chunk[65536];
+    while (true) {
+        int taken = takeMessage(buffer, message);
+        if (taken != 0)
+            return taken > 0;
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+    }
+}
+
+// Local workers each get their own range of cores from firstCore on
+int runWorker(const std::string& address, unsigned threads, unsigned firstCore) {
+    int fd = -1;
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS && fd < 0; attempt++) {
+        fd = connectTo(address);
+        if (fd < 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (fd < 0) {
+        std::cerr << "Could not connect to " << address << std::endl;
+        return 1;
+    }
+
+    TileScheduler scheduler(threads, 32, firstCore);
+    Palette<RGB> palette(MAX_ITERATIONS, getColor);
+    ViewportRenderer renderer;
+    RenderJob job;
+    bool hasJob = false;
+    std::vector<int> values;
+    std::vector<RGB> colors;
+
+    std::string hello;
+    putWord(hello, scheduler.getThreadCount());
+    if (!sendAll(fd, encodeMessage(HELLO, 0, hello.data(), hello.size()))) {
+        close(fd);
+        return 1;
+    }
+
+    std::string buffer;
+    Message message;
+    long long bands = 0;
+    while (receiveMessage(fd, buffer, message)) {
+        if (message.type == JOB) {
+            hasJob = job.parse(message.payload);
+            if (!hasJob) {
+                std::cerr << "Worker: job does not match this build: " << message.payload << std::endl;
+                break;
+            }
+            Viewport view(job.width, job.height, job.zoom, job.real, job.imag);
+            renderer.beginFrame(view, MAX_ITERATIONS);
+            values.resize(static_cast<size_t>(job.width) * BAND_HEIGHT);
+            colors.resize(static_cast<size_t>(job.width) * BAND_HEIGHT);
+            continue;
+        }
+        if (message.type != BAND || !hasJob || static_cast<int>(message.band) >= job.getBandCount())
+            break;
+
+        int band = static_cast<int>(message.band);
+        int y0 = job.bandStart(band), y1 = job.bandEnd(band);
+        std::vector<Tile> tiles = scheduler.makeTiles(job.width, y1 - y0);
+        scheduler.run(tiles, [&](const Tile& tile) {
+            for (int y = tile.y0; y < tile.y1; y++) {
+                int* row = &values[static_cast<size_t>(y) * job.width];
+                renderer.iterateRow(y0 + y, tile.x0, tile.x1, row + tile.x0);
+                palette.colorize(row + tile.x0, tile.x1 - tile.x0, &colors[static_cast<size_t>(y) * job.width + tile.x0]);
+            }
+        });
+
+        size_t bytes = static_cast<size_t>(job.width) * (y1 - y0) * sizeof(RGB);
+        if (!sendAll(fd, encodeMessage(RESULT, message.band, reinterpret_cast<const char*>(colors.data()), bytes)))
+            break;
+        bands++;
+    }
+    close(fd);
+    std::cerr << "Worker " << getpid() << ": " << bands << " bands" << std::endl;
+    return 0;
+}
+
+class Coordinator {
+public:
+    Coordinator(int listenFd, const RenderJob& job, StreamingImageWriter& writer)
+        : listenFd(listenFd), job(job), writer(writer), bandCount(job.getBandCount()), done(bandCount, 0), copies(bandCount, 0) {
+        for (int band = 0; band < bandCount; band++) {
+            pending.push_back(band);
+        }
+    }
+
+    // Runs until every band is written
+    void run() {
+        auto start = Clock::now();
+        int lastReported = -1;
+        std::vector<pollfd> fds;
+        while (doneCount < bandCount) {
+            fds.clear();
+            fds.push_back({listenFd, POLLIN, 0});
+            for (const WorkerConnection& worker : workers) {
+                fds.push_back({worker.fd, static_cast<short>(POLLIN | (worker.output.empty() ? 0 : POLLOUT)), 0});
+            }
+            if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) {
+                std::cerr << "poll failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+
+            // Workers are dropped from the back so the indices stay valid
+            for (size_t i = workers.size(); i-- > 0;) {
+                short revents = fds[i + 1].revents;
+                bool alive = true;
+                if (revents & (POLLIN | POLLHUP | POLLERR))
+                    alive = readFrom(workers[i]);
+                if (alive && (revents & POLLOUT))
+                    alive = writeTo(workers[i]);
+                if (!alive)
+                    dropWorker(i, "disconnected");
+            }
+            if (fds[0].revents & POLLIN)
+                acceptWorkers();
+
+            dropTimedOut();
+            assignBands();
+
+            int percent = static_cast<int>(100LL * doneCount / bandCount);
+            if (percent != lastReported) {
+                double seconds = millisecondsBetween(start, Clock::now()) / 1000.0;
+                std::cout << "\r" << percent << "% (" << doneCount << " of " << bandCount << " bands, " << workers.size() << " workers, "
+                          << static_cast<int>(seconds) << " s)" << std::flush;
+                lastReported = percent;
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    // Closing the connections lets the workers exit
+    void finish() {
+        for (size_t i = workers.size(); i-- > 0;) {
+            printWorker(workers[i]);
+            close(workers[i].fd);
+        }
+        workers.clear();
+        std::cout << "Bands reassigned from lost workers: " << reassigned << ", backup copies: " << backups << ", duplicate results discarded: "
+                  << duplicates << std::endl;
+    }
+
+private:
+    struct Assignment {
+        int band;
+        Clock::time_point assigned;
+    };
+
+    struct WorkerConnection {
+        int fd;
+        int id;
+        unsigned threads = 0; // 0 until its hello arrived
+        std::string input;
+        std::string output;
+        std::deque<Assignment> bands; // Rendered in this order
+        Clock::time_point lastResult;
+        long long written = 0;
+    };
+
+    int listenFd;
+    const RenderJob& job;
+    StreamingImageWriter& writer;
+    int bandCount;
+    int doneCount = 0;
+    std::vector<char> done;
+    std::vector<int> copies; // Workers holding each band
+    std::deque<int> pending;
+    std::vector<WorkerConnection> workers;
+    int nextWorkerId = 1;
+
+    std::vector<double> bandMs; // Recent band times, for the median
+    size_t bandMsNext = 0;
+    long long reassigned = 0;
+    long long backups = 0;
+    long long duplicates = 0;
+
+    void acceptWorkers() {
+        while (true) {
+            pollfd ready{listenFd, POLLIN, 0};
+            if (poll(&ready, 1, 0) <= 0)
+                return;
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+                return;
+            WorkerConnection worker;
+            worker.fd = fd;
+            worker.id = nextWorkerId++;
+            worker.lastResult = Clock::now();
+            std::string description = job.serialize();
+            worker.output = encodeMessage(JOB, 0, description.data(), description.size());
+            workers.push_back(std::move(worker));
+        }
+    }
+
+    bool readFrom(WorkerConnection& worker) {
+        char chunk[65536];
+        ssize_t n = recv(worker.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            return false;
+        if (n > 0)
+            worker.input.append(chunk, n);
+
+        Message message;
+        int taken;
+        while ((taken = takeMessage(worker.input, message)) > 0) {
+            if (message.type == HELLO && message.payload.size() == 4) {
+                worker.threads = std::max(1u, getWord(message.payload, 0));
+                std::cout << "\rWorker " << worker.id << " joined with " << worker.threads << " threads" << std::endl;
+            } else if (message.type != RESULT || !takeResult(worker, message)) {
+                return false;
+            }
+        }
+        return taken == 0;
+    }
+
+    bool writeTo(WorkerConnection& worker) {
+        while (!worker.output.empty()) {
+            ssize_t n = send(worker.fd, worker.output.data(), worker.output.size(), MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            worker.output.erase(0, static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    bool takeResult(WorkerConnection& worker, const Message& message) {
+        int band = static_cast<int>(message.band);
+        auto it = std::find_if(worker.bands.begin(), worker.bands.end(), [&](const Assignment& a) { return a.band == band; });
+        if (it == worker.bands.end())
+            return false;
+        size_t rows = job.bandEnd(band) - job.bandStart(band);
+        if (message.payload.size() != rows * job.width * sizeof(RGB))
+            return false;
+
+        // The band started when the one before it on this worker finished
+        auto now = Clock::now();
+        recordBandMs(millisecondsBetween(std::max(it->assigned, worker.lastResult), now));
+        worker.lastResult = now;
+        worker.bands.erase(it);
+        copies[band]--;
+
+        if (done[band]) {
+            duplicates++;
+            return true;
+        }
+        writer.writeRows(job.bandStart(band), static_cast<int>(rows), reinterpret_cast<const unsigned char*>(message.payload.data()));
+        done[band] = 1;
+        doneCount++;
+        worker.written++;
+        return true;
+    }
+
+    void recordBandMs(double ms) {
+        const size_t samples = 256;
+        if (bandMs.size() < samples)
+            bandMs.push_back(ms);
+        else
+            bandMs[bandMsNext] = ms;
+        bandMsNext = (bandMsNext + 1) % samples;
+    }
+
+    // How long the band a worker is on has been running
+    static double runningMs(const WorkerConnection& worker, Clock::time_point now) {
+        return worker.bands.empty() ? 0 : millisecondsBetween(std::max(worker.bands.front().assigned, worker.lastResult), now);
+    }
+
+    void dropWorker(size_t index, const char* reason) {
+        WorkerConnection& worker = workers[index];
+        std::cout << "\rWorker " << worker.id << " " << reason << " holding " << worker.bands.size() << " bands" << std::endl;
+        for (auto it = worker.bands.rbegin(); it != worker.bands.rend(); ++it) {
+            copies[it->band]--;
+            if (!done[it->band] && copies[it->band] == 0) {
+                pending.push_front(it->band);
+                reassigned++;
+            }
+        }
+        close(worker.fd);
+        workers.erase(workers.begin() + index);
+    }
+
+    void dropTimedOut() {
+        auto now = Clock::now();
+        for (size_t i = workers.size(); i-- > 0;) {
+            if (runningMs(workers[i], now) > WORKER_TIMEOUT_MS)
+                dropWorker(i, "timed out");
+        }
+    }
+
+    void assignBands() {
+        for (WorkerConnection& worker : workers) {
+            while (worker.threads > 0 && static_cast<int>(worker.bands.size()) < PIPELINE_DEPTH) {
+                int band = nextBand(worker);
+                if (band < 0)
+                    break;
+                worker.bands.push_back({band, Clock::now()});
+                copies[band]++;
+                worker.output += encodeMessage(BAND, static_cast<uint32_t>(band));
+            }
+            if (!worker.output.empty())
+                writeTo(worker); // Errors show up as POLLERR next turn
+        }
+    }
+
+    // A pending band, or else a backup copy of the lowest band held by a
+    // straggler, or -1
+    int nextBand(const WorkerConnection& worker) {
+        while (!pending.empty()) {
+            int band = pending.front();
+            pending.pop_front();
+            if (!done[band])
+                return band;
+        }
+
+        double threshold = MIN_BACKUP_MS;
+        if (!bandMs.empty()) {
+            std::vector<double> sorted(bandMs);
+            std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+            threshold = std::max(threshold, BACKUP_FACTOR * sorted[sorted.size() / 2]);
+        }
+
+        auto now = Clock::now();
+        int best = -1;
+        for (const WorkerConnection& other : workers) {
+            if (&other == &worker || runningMs(other, now) < threshold)
+                continue;
+            for (const Assignment& a : other.bands) {
+                bool mine = std::any_of(worker.bands.begin(), worker.bands.end(), [&](const Assignment& b) { return b.band == a.band; });
+                if (!done[a.band] && copies[a.band] < 2 && !mine && (best < 0 || a.band < best))
+                    best = a.band;
+            }
+        }
+        if (best >= 0)
+            backups++;
+        return best;
+    }
+
+    void printWorker(const WorkerConnection& worker) const {
+        std::cout << "Worker " << worker.id << " (" << worker.threads << " threads): " << worker.written << " bands written" << std::endl;
+    }
+};
+
+// width height [zoom real imag] from argv[first]
+bool parseJob(int argc, char* argv[], int first, RenderJob& job) {
+    int count = argc - first;
+    if (count != 0 && count != 2 && count != 5)
+        return false;
+    if (count >= 2) {
+        job.width = std::stoi(argv[first]);
+        job.height = std::stoi(argv[first + 1]);
+    }
+    if (count == 5) {
+        job.zoom = std::stod(argv[first + 2]);
+        job.real = argv[first + 3];
+        job.imag = argv[first + 4];
+    }
+    return job.width > 0 && job.height > 0;
+}
+
+int listenOrComplain(const std::string& address) {
+    int listenFd = listenOn(address);
+    if (listenFd < 0)
+        std::cerr << "Could not listen on " << address << ": " << std::strerror(errno) << std::endl;
+    return listenFd;
+}
+
+int runCoordinator(int listenFd, const std::string& address, const RenderJob& job) {
+    StreamingImageWriter writer(OUTPUT_FILE, job.width, job.height);
+    if (!writer.isGood()) {
+        close(listenFd);
+        return 1;
+    }
+
+    std::cout << "Rendering " << job.width << " x " << job.height << " in " << job.getBandCount() << " bands; waiting for workers on " << address << std::endl;
+    auto start = Clock::now();
+    Coordinator coordinator(listenFd, job, writer);
+    coordinator.run();
+    coordinator.finish();
+    close(listenFd);
+    if (address.compare(0, 5, "unix:") == 0)
+        unlink(address.substr(5).c_str());
+
+    std::cout << "Rendered in " << millisecondsBetween(start, Clock::now()) / 1000.0 << " s" << std::endl;
+    if (!writer.isGood()) {
+        std::cerr << "Could not write " << OUTPUT_FILE << std::endl;
+        return 1;
+    }
+    std::cout << "Mandelbrot set image saved as " << OUTPUT_FILE << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // A lost worker must not take the coordinator down
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::string mode = argc >= 2 ? argv[1] : "";
+    RenderJob job;
+    if (mode == "worker" && argc >= 3) {
+        unsigned threads = argc >= 4 ? static_cast<unsigned>(std::stoi(argv[3])) : std::thread::hardware_concurrency();
+        // Another machine may be running anything else, so its cores are not ours to pin
+        return runWorker(argv[2], threads, TileScheduler::UNPINNED);
+    }
+    if (mode == "coordinator" && argc >= 3 && parseJob(argc, argv, 3, job)) {
+        int listenFd = listenOrComplain(argv[2]);
+        return listenFd < 0 ? 1 : runCoordinator(listenFd, argv[2], job);
+    }
+    if (mode == "local" && parseJob(argc, argv, std::min(argc, 3), job)) {
+        int workerCount = argc >= 3 ? std::max(1, std::stoi(argv[2])) : 4;
+        std::string address = "unix:/tmp/mandelbrot_distributed_" + std::to_string(getpid()) + ".sock";
+        // The cores are shared between the local workers
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency() / workerCount);
+
+        // Listening before the workers start, so none of them has to retry;
+        // forked before the coordinator starts any thread
+        int listenFd = listenOrComplain(address);
+        if (listenFd < 0)
+            return 1;
+        std::vector<pid_t> children;
+        for (int i = 0; i < workerCount; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listenFd);
+                _exit(runWorker(address, threads, i * threads));
+            }
+            if (pid > 0)
+                children.push_back(pid);
+        }
+        int result = runCoordinator(listenFd, address, job);
+        for (pid_t pid : children) {
+            if (result != 0)
+                kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+        return result;
+    }
+
+    std::cerr << "Usage: " << argv[0] << " local [workers] [width height [zoom real imag]]\n"
+              << "       " << argv[0] << " coordinator <unix:/path | host:port> [width height [zoom real imag]]\n"
+              << "       " << argv[0] << " worker <unix:/path | host:port> [threads]" << std::endl;
+    return 1;
+}
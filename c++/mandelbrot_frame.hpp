@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "mandelbrot_viewport.hpp"
+#include "tile_scheduler.hpp"
+
+// Iteration counts of the last rendered frame together with the viewport they
+// belong to.
+//
+// When the next viewport is the same pixel grid moved by a whole number of
+// pixels (a pan), the old counts are shifted in place and only the newly
+// exposed rows and columns are iterated. Anything else, or a change of
+// precision or iteration cap, re-renders the whole frame. A pan that is
+// cancelled keeps the frame: the tiles it did not finish are iterated with
+// the strips of the next pan, so holding an arrow key never falls back to a
+// full re-render however long the strips take.
+//
+// A full re-render is done progressively in passes of every 4th, every 2nd
+// and finally every pixel in each direction (1/16, 1/4 and all of the
+// pixels). Each pass only iterates the pixels the previous passes have not,
+// and coloring with getStep() fills the gaps from the nearest sample above
+// and to the left, so every pass can be shown as soon as it is done. A pass can be cancelled
+// half-way; the frame is then re-rendered from scratch next time.
+
+class IterationFrame {
+public:
+    // Called on the worker once all rows of a tile of a pass are done
+    using TileDoneFn = std::function<void(const Tile&)>;
+
+    IterationFrame(int width, int height) : width(width), height(height), iterations(width * height), last(width, height) {}
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const int* data() const { return iterations.data(); }
+
+    // Pixel spacing of the samples rendered so far (1 once the frame is complete)
+    int getStep() const { return step; }
+
+    // Spacing of the samples once the pending pass is done
+    int getPassStep() const { return passes.empty() ? step : passes.front().step; }
+
+    // The frame was shifted by begin() and only the exposed strips are
+    // iterated; the tiles of that pass do not follow the scheduler grid
+    bool isPanning() const { return panning; }
+
+    // Pixels iterated by the passes since begin()
+    long long getRenderedPixels() const { return renderedPixels; }
+
+    // Plans the passes for view. Call submitPass() / finishPass() until
+    // hasPendingPass() is false.
+    void begin(const Viewport& view, ViewportRenderer& renderer, int maxIterations, int tileSize) {
+        renderer.beginFrame(view, maxIterations);
+        this->renderer = &renderer;
+
+        long long dx = view.offsetX - last.offsetX;
+        long long dy = view.offsetY - last.offsetY;
+        bool reusable = valid && view.sameGrid(last) && maxIterations == lastMaxIterations &&
+                        renderer.getPrecision() == lastPrecision && std::llabs(dx) < width && std::llabs(dy) < height;
+
+        passes.clear();
+        panning = reusable;
+        if (reusable) {
+            shift(static_cast<int>(dx), static_cast<int>(dy));
+            std::vector<Tile> tiles = exposedTiles(static_cast<int>(dx), static_cast<int>(dy), tileSize);
+            std::vector<Tile> holes = shiftedHoles(static_cast<int>(dx), static_cast<int>(dy));
+            tiles.insert(tiles.end(), holes.begin(), holes.end());
+            passes.push_back({1, false, tiles});
+        } else {
+            std::vector<Tile> tiles = makeTiles(0, 0, width, height, tileSize);
+            step = COARSEST_STEP;
+            for (int passStep = COARSEST_STEP; passStep >= 1; passStep /= 2) {
+                passes.push_back({passStep, passStep != COARSEST_STEP, tiles});
+            }
+        }
+
+        renderedPixels = 0;
+        last = view;
+        lastMaxIterations = maxIterations;
+        lastPrecision = renderer.getPrecision();
+        // A shifted frame stays reusable, with the tiles of its pan as holes
+        // until they are done; a new one only once its last pass completed
+        valid = reusable;
+        unfinished = reusable ? passes.front().tiles : std::vector<Tile>();
+    }
+
+    // Takes over a complete frame of view rendered elsewhere (width x height
+    // counts), so the next begin() can shift it like a frame rendered here
+    void adopt(const Viewport& view, ViewportRenderer& renderer, int maxIterations, const int* counts) {
+        renderer.beginFrame(view, maxIterations);
+        this->renderer = &renderer;
+        std::copy_n(counts, iterations.size(), iterations.begin());
+
+        passes.clear();
+        unfinished.clear();
+        panning = false;
+        step = 1;
+        renderedPixels = 0;
+        last = view;
+        lastMaxIterations = maxIterations;
+        lastPrecision = renderer.getPrecision();
+        valid = true;
+    }
+
+    bool hasPendingPass() const { return !passes.empty(); }
+
+    // Starts the next pass on the scheduler and returns immediately. Rows stop
+    // early once the scheduler or the optional cancel flag is cancelled;
+    // tileDone is only called for tiles that were completed.
+    void submitPass(TileScheduler& scheduler, const std::atomic<bool>* cancel = nullptr, const TileDoneFn& tileDone = nullptr) {
+        const Pass& pass = passes.front();
+        int passStep = pass.step;
+        bool refine = pass.refine;
+
+        for (const Tile& tile : pass.tiles) {
+            renderedPixels += countPixels(tile, passStep, refine);
+        }
+        doneTiles.clear();
+
+        scheduler.submit(pass.tiles, [this, &scheduler, passStep, refine, cancel, tileDone](const Tile& tile) {
+            thread_local std::vector<int> values;
+            values.resize(tile.x1 - tile.x0);
+
+            for (int y = tile.y0; y < tile.y1; y++) {
+                if (scheduler.isCancelled() || (cancel && cancel->load(std::memory_order_relaxed)))
+                    return;
+                if (y % passStep != 0)
+                    continue;
+
+                int x0, xStep;
+                rowSamples(tile.x0, y, passStep, refine, x0, xStep);
+                renderer->iterateRow(y, x0, tile.x1, values.data(), xStep);
+                for (int x = x0, i = 0; x < tile.x1; x += xStep, i++) {
+                    iterations[y * width + x] = values[i];
+                }
+            }
+            if (panning) {
+                std::lock_guard<std::mutex> lock(doneMtx);
+                doneTiles.push_back(tile);
+            }
+            if (tileDone)
+                tileDone(tile);
+        });
+    }
+
+    // Waits for the pass started by submitPass(). Returns false if it was
+    // cancelled, in which case the remaining passes are dropped; the tiles a
+    // cancelled pan did not finish are kept for the next begin().
+    bool finishPass(TileScheduler& scheduler, std::vector<WorkerStats>& stats, const std::atomic<bool>* cancel = nullptr) {
+        stats = scheduler.wait();
+        if (scheduler.isCancelled() || (cancel && cancel->load())) {
+            if (panning) {
+                unfinished.erase(std::remove_if(unfinished.begin(), unfinished.end(), [&](const Tile& tile) { return isDone(tile); }),
+                                 unfinished.end());
+            }
+            passes.clear();
+            return false;
+        }
+
+        step = passes.front().step;
+        passes.erase(passes.begin());
+        valid = passes.empty();
+        if (valid)
+            unfinished.clear();
+        return true;
+    }
+
+    // Renders every pass of view, blocking until the frame is complete
+    std::vector<WorkerStats> render(const Viewport& view, ViewportRenderer& renderer, TileScheduler& scheduler, int maxIterations) {
+        std::vector<WorkerStats> stats;
+        begin(view, renderer, maxIterations, scheduler.getTileSize());
+        while (hasPendingPass()) {
+            submitPass(scheduler);
+            finishPass(scheduler, stats);
+        }
+        return stats;
+    }
+
+private:
+    static const int COARSEST_STEP = 4;
+
+    struct Pass {
+        int step;
+        bool refine; // Follows a pass of twice the step, whose samples are kept
+        std::vector<Tile> tiles;
+    };
+
+    int width;
+    int height;
+    std::vector<int> iterations;
+    int step = 1;
+
+    Viewport last;
+    int lastMaxIterations = 0;
+    Precision lastPrecision = Precision::Auto;
+    bool valid = false;
+
+    ViewportRenderer* renderer = nullptr;
+    std::vector<Pass> passes;
+    bool panning = false;
+    long long renderedPixels = 0;
+
+    // Tiles of a valid frame whose counts are not there yet: those of the
+    // pan in progress, or of a cancelled one
+    std::vector<Tile> unfinished;
+    std::mutex doneMtx;
+    std::vector<Tile> doneTiles; // Of the pan in progress
+
+    bool isDone(const Tile& tile) const {
+        return std::any_of(doneTiles.begin(), doneTiles.end(), [&](const Tile& done) {
+            return done.x0 == tile.x0 && done.y0 == tile.y0 && done.x1 == tile.x1 && done.y1 == tile.y1;
+        });
+    }
+
+    static std::vector<Tile> makeTiles(int x0, int y0, int x1, int y1, int tileSize) {
+        std::vector<Tile> tiles;
+        for (int y = y0; y < y1; y += tileSize) {
+            for (int x = x0; x < x1; x += tileSize) {
+                tiles.push_back({x, y, std::min(x + tileSize, x1), std::min(y + tileSize, y1)});
+            }
+        }
+        return tiles;
+    }
+
+    // First sample at or after tileX0 on row y of a pass, and the spacing of
+    // the samples. When refining, every other sample on the rows of the
+    // previous pass is already done.
+    static void rowSamples(int tileX0, int y, int passStep, bool refine, int& x0, int& xStep) {
+        int phase = 0;
+        xStep = passStep;
+        if (refine && y % (2 * passStep) == 0) {
+            phase = passStep;
+            xStep = 2 * passStep;
+        }
+        x0 = tileX0 + ((phase - tileX0 % xStep) % xStep + xStep) % xStep;
+    }
+
+    static long long countPixels(const Tile& tile, int passStep, bool refine) {
+        long long count = 0;
+        for (int y = tile.y0; y < tile.y1; y++) {
+            if (y % passStep != 0)
+                continue;
+            int x0, xStep;
+            rowSamples(tile.x0, y, passStep, refine, x0, xStep);
+            if (x0 < tile.x1)
+                count += (tile.x1 - x0 + xStep - 1) / xStep;
+        }
+        return count;
+    }
+
+    // New pixel (x, y) takes the old pixel (x + dx, y + dy)
+    void shift(int dx, int dy) {
+        int srcX = std::max(0, dx), dstX = std::max(0, -dx);
+        int count = width - std::abs(dx);
+
+        if (dy >= 0) {
+            for (int y = 0; y + dy < height; y++) {
+                std::memmove(&iterations[y * width + dstX], &iterations[(y + dy) * width + srcX], count * sizeof(int));
+            }
+        } else {
+            for (int y = height - 1; y + dy >= 0; y--) {
+                std::memmove(&iterations[y * width + dstX], &iterations[(y + dy) * width + srcX], count * sizeof(int));
+            }
+        }
+    }
+
+    // Tiles covering the rows and columns that have no old pixel after shift()
+    std::vector<Tile> exposedTiles(int dx, int dy, int tileSize) const {
+        std::vector<Tile> tiles;
+        int keptY0 = 0, keptY1 = height;
+
+        if (dy > 0) {
+            tiles = makeTiles(0, height - dy, width, height, tileSize);
+            keptY1 = height - dy;
+        } else if (dy < 0) {
+            tiles = makeTiles(0, 0, width, -dy, tileSize);
+            keptY0 = -dy;
+        }
+
+        std::vector<Tile> columns;
+        if (dx > 0) {
+            columns = makeTiles(width - dx, keptY0, width, keptY1, tileSize);
+        } else if (dx < 0) {
+            columns = makeTiles(0, keptY0, -dx, keptY1, tileSize);
+        }
+        tiles.insert(tiles.end(), columns.begin(), columns.end());
+        return tiles;
+    }
+
+    // The unfinished tiles moved along with shift(), without the parts that
+    // went off the frame or that exposedTiles() covers anyway
+    std::vector<Tile> shiftedHoles(int dx, int dy) const {
+        int keptX0 = std::max(0, -dx), keptX1 = width - std::max(0, dx);
+        int keptY0 = std::max(0, -dy), keptY1 = height - std::max(0, dy);
+        std::vector<Tile> holes;
+        for (const Tile& tile : unfinished) {
+            Tile hole = {std::max(tile.x0 - dx, keptX0), std::max(tile.y0 - dy, keptY0), std::min(tile.x1 - dx, keptX1), std::min(tile.y1 - dy, keptY1)};
+            if (hole.x0 < hole.x1 && hole.y0 < hole.y1)
+                holes.push_back(hole);
+        }
+        return holes;
+    }
+};
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FRAME_CACHE_DISK 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define FRAME_CACHE_DISK 0
+#endif
+
+#include "mandelbrot_viewport.hpp"
+
+// Cache of rendered iteration counts, one complete frame per view (needs
+// -lgmpxx -lgmp).
+//
+// A frame is keyed by everything its pixels depend on: the exact grid anchor
+// and zoom, the pixel offsets from the anchor, the size, the iteration cap
+// and the precision. Pixels on one grid get bitwise-identical coordinates
+// however the view got there (see Viewport), so a hit is exactly the frame a
+// render of the view would give. Panning back, or zooming out again without
+// having panned, finds the frame in the in-memory LRU or the optional disk
+// store and costs a lookup instead of a render.
+//
+// A view only hits if it is the same view down to the last bit: a zoom step
+// in and back out can land on a zoom one ulp off, which is a different grid
+// and is rendered.
+
+// Exact identity of a frame of view, also written into its file
+inline std::string frameKey(const Viewport& view, int maxIterations) {
+    mp_exp_t realExponent, imagExponent;
+    std::ostringstream key;
+    key << view.width << "x" << view.height << " " << std::hexfloat << view.zoom << std::defaultfloat << " "
+        << view.centerReal.get_str(realExponent, 16, 0) << "@" << realExponent << " " << view.centerImag.get_str(imagExponent, 16, 0) << "@"
+        << imagExponent << " " << view.offsetX << "," << view.offsetY << " " << maxIterations << " "
+        << precisionName(ViewportRenderer::precisionFor(view));
+    return key.str();
+}
+
+// One file per frame under a directory, read back through mmap. Files are
+// named by a hash of the key and start with the key itself, so a hash
+// collision reads as a miss. They are written under a temporary name and
+// renamed, so a crash never leaves a truncated frame behind.
+//
+// save() only queues the frame; a thread of the store writes it, so the
+// caller never waits for the disk. The directory is kept below maxBytes by
+// deleting the oldest frames, counting the ones left by earlier runs.
+class FrameDiskStore {
+public:
+    explicit FrameDiskStore(const std::string& directory = "", size_t maxBytes = size_t(1) << 30) : directory(directory), maxBytes(maxBytes) {
+#if FRAME_CACHE_DISK
+        if (!directory.empty()) {
+            mkdir(directory.c_str(), 0755);
+            writer = std::thread(&FrameDiskStore::writeThread, this);
+        }
+#endif
+    }
+
+    // Writes whatever is still queued
+    ~FrameDiskStore() {
+        if (!writer.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        queued.notify_one();
+        writer.join();
+    }
+
+    FrameDiskStore(const FrameDiskStore&) = delete;
+    FrameDiskStore& operator=(const FrameDiskStore&) = delete;
+
+    bool isEnabled() const { return FRAME_CACHE_DISK && !directory.empty(); }
+
+    bool load(const std::string& key, std::vector<int>& iterations, size_t count) const {
+#if FRAME_CACHE_DISK
+        if (!isEnabled())
+            return false;
+        int fd = open(path(key).c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        size_t header = key.size() + 1;
+        size_t bytes = header + count * sizeof(int);
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) == bytes;
+        if (ok) {
+            void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = mapped != MAP_FAILED;
+            if (ok) {
+                const char* data = static_cast<const char*>(mapped);
+                ok = std::memcmp(data, key.c_str(), header) == 0;
+                if (ok) {
+                    iterations.resize(count);
+                    std::memcpy(iterations.data(), data + header, count * sizeof(int));
+                }
+                munmap(mapped, bytes);
+            }
+        }
+        close(fd);
+        return ok;
+#else
+        (void)key;
+        (void)iterations;
+        (void)count;
+        return false;
+#endif
+    }
+
+    // Queues the frame for writing and returns immediately
+    void save(const std::string& key, std::vector<int> iterations) {
+        if (!isEnabled())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            pending.push_back({key, std::move(iterations)});
+        }
+        queued.notify_one();
+    }
+
+private:
+    struct PendingFrame {
+        std::string key;
+        std::vector<int> iterations;
+    };
+
+    struct StoredFrame {
+        long long time;
+        std::string path;
+        size_t bytes;
+    };
+
+    std::string directory;
+    size_t maxBytes;
+
+    std::mutex mtx;
+    std::condition_variable queued;
+    std::deque<PendingFrame> pending;
+    bool stopping = false;
+    std::thread writer;
+
+    // Writer thread only; oldest first
+    std::deque<StoredFrame> stored;
+    size_t storedBytes = 0;
+
+    // FNV-1a of the key
+    std::string path(const std::string& key) const {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 0x100000001B3ull;
+        }
+        std::ostringstream name;
+        name << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".frame";
+        return name.str();
+    }
+
+    void writeThread() {
+        scan();
+        while (true) {
+            PendingFrame frame;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                queued.wait(lock, [&]() { return stopping || !pending.empty(); });
+                if (pending.empty())
+                    return;
+                frame = std::move(pending.front());
+                pending.pop_front();
+            }
+            std::string target = path(frame.key);
+            if (write(target, frame.key, frame.iterations)) {
+                // A frame written again replaces its old file
+                size_t bytes = frame.key.size() + 1 + frame.iterations.size() * sizeof(int);
+                stored.push_back({0, target, bytes});
+                storedBytes += bytes;
+                evict();
+            }
+        }
+    }
+
+    bool write(const std::string& target, const std::string& key, const std::vector<int>& iterations) {
+#if FRAME_CACHE_DISK
+        std::string temporary = target + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        bool ok = writeAll(fd, key.c_str(), key.size() + 1) &&
+                  writeAll(fd, reinterpret_cast<const char*>(iterations.data()), iterations.size() * sizeof(int));
+        close(fd);
+
+        if (ok && rename(temporary.c_str(), target.c_str()) == 0)
+            return true;
+        unlink(temporary.c_str());
+        return false;
+#else
+        (void)target;
+        (void)key;
+        (void)iterations;
+        return false;
+#endif
+    }
+
+#if FRAME_CACHE_DISK
+    static bool writeAll(int fd, const char* data, size_t bytes) {
+        size_t written = 0;
+        while (written < bytes) {
+            ssize_t n = ::write(fd, data + written, bytes - written);
+            if (n <= 0)
+                return false;
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+#endif
+
+    // Counts the frames of earlier runs, oldest first, and drops leftover
+    // temporary files
+    void scan() {
+#if FRAME_CACHE_DISK
+        DIR* dir = opendir(directory.c_str());
+        if (!dir)
+            return;
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            std::string file = directory + "/" + name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+                unlink(file.c_str());
+                continue;
+            }
+            struct stat info;
+            if (name.size() > 6 && name.compare(name.size() - 6, 6, ".frame") == 0 && stat(file.c_str(), &info) == 0) {
+                stored.push_back({static_cast<long long>(info.st_mtime), file, static_cast<size_t>(info.st_size)});
+                storedBytes += static_cast<size_t>(info.st_size);
+            }
+        }
+        closedir(dir);
+        std::stable_sort(stored.begin(), stored.end(), [](const StoredFrame& a, const StoredFrame& b) { return a.time < b.time; });
+        evict();
+#endif
+    }
+
+    void evict() {
+#if FRAME_CACHE_DISK
+        while (storedBytes > maxBytes && !stored.empty()) {
+            // Only the newest entry of a rewritten frame owns the file
+            const std::string& oldest = stored.front().path;
+            bool rewritten = std::any_of(stored.begin() + 1, stored.end(), [&](const StoredFrame& frame) { return frame.path == oldest; });
+            if (!rewritten)
+                unlink(oldest.c_str());
+            storedBytes -= stored.front().bytes;
+            stored.pop_front();
+        }
+#endif
+    }
+};
+
+class FrameCache {
+public:
+    explicit FrameCache(size_t maxBytes = 256u << 20, const std::string& diskDirectory = "", size_t maxDiskBytes = size_t(1) << 30)
+        : maxBytes(maxBytes), disk(diskDirectory, maxDiskBytes) {}
+
+    // The counts of a complete frame of view (width x height), from memory or
+    // disk, or nullptr. Valid until the next find() or store().
+    const int* find(const Viewport& view, int maxIterations) {
+        std::string key = frameKey(view, maxIterations);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            order.splice(order.begin(), order, it->second.position);
+            hits++;
+            return it->second.iterations.data();
+        }
+
+        std::vector<int> loaded;
+        if (disk.load(key, loaded, static_cast<size_t>(view.width) * view.height)) {
+            hits++;
+            diskHits++;
+            return insert(key, std::move(loaded)).data();
+        }
+        misses++;
+        return nullptr;
+    }
+
+    // Whether view is in memory, without counting a lookup
+    bool contains(const Viewport& view, int maxIterations) const { return entries.count(frameKey(view, maxIterations)) > 0; }
+
+    // Keeps a complete frame of view, in memory and on disk
+    void store(const Viewport& view, int maxIterations, const int* iterations) {
+        std::string key = frameKey(view, maxIterations);
+        if (entries.count(key))
+            return;
+        std::vector<int> frame(iterations, iterations + static_cast<size_t>(view.width) * view.height);
+        disk.save(key, frame);
+        insert(key, std::move(frame));
+    }
+
+    long long getHits() const { return hits; }
+    long long getDiskHits() const { return diskHits; }
+    long long getMisses() const { return misses; }
+    size_t getFrameCount() const { return entries.size(); }
+
+private:
+    struct Entry {
+        std::vector<int> iterations;
+        std::list<std::string>::iterator position;
+    };
+
+    size_t maxBytes;
+    size_t bytes = 0;
+    FrameDiskStore disk;
+
+    // Most recently used first
+    std::list<std::string> order;
+    std::unordered_map<std::string, Entry> entries;
+
+    long long hits = 0;
+    long long diskHits = 0;
+    long long misses = 0;
+
+    // The newest frame is always kept, even if it alone is over maxBytes
+    const std::vector<int>& insert(const std::string& key, std::vector<int> iterations) {
+        size_t frameBytes = iterations.size() * sizeof(int);
+        while (!entries.empty() && bytes + frameBytes > maxBytes) {
+            auto oldest = entries.find(order.back());
+            bytes -= oldest->second.iterations.size() * sizeof(int);
+            entries.erase(oldest);
+            order.pop_back();
+        }
+
+        order.push_front(key);
+        Entry& entry = entries[key];
+        entry.iterations = std::move(iterations);
+        entry.position = order.begin();
+        bytes += frameBytes;
+        return entry.iterations;
+    }
+};
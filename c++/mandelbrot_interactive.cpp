@@ -1,31 +1,59 @@
 #include <iostream>
 #include <SFML/Graphics.hpp>
-#include <complex>
 
-#include <thread>
-#include <vector>
 #include <chrono>
+#include <cmath>
+#include <sstream>
 #include <thread>
 #include <vector>
-#include <chrono>
-#include <atomic>
 #include <fstream>
 
-#define USE_FUTURE 1
+#include "frame_profiler.hpp"
+#include "julia_preview.hpp"
+#include "mandelbrot_kernel.hpp"
+#include "mandelbrot_palette.hpp"
+#include "mandelbrot_viewport.hpp"
+#include "render_engine.hpp"
+#include "tile_scheduler.hpp"
 
-# if USE_FUTURE
-#include <future>
-#endif
-
-// g++ -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lpthread && ./mandelbrot_interactive
+// g++ -O2 -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lgmpxx -lgmp -lpthread && ./mandelbrot_interactive
 // Using starting coordinates for pan and zoom (see last_coordinates.txt)
-// g++ -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lpthread && ./mandelbrot_interactive 1 -0.3 0
-// g++ -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lpthread && ./mandelbrot_interactive 26854.6 -1.24993 -0.0125627
+// g++ -O2 -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lgmpxx -lgmp -lpthread && ./mandelbrot_interactive 1 -0.3 0
+// g++ -O2 -o mandelbrot_interactive mandelbrot_interactive.cpp -lsfml-graphics -lsfml-window -lsfml-system -lgmpxx -lgmp -lpthread && ./mandelbrot_interactive 26854.6 -1.24993 -0.0125627
 
 const int WIDTH = 1280;
 const int HEIGHT = 800;
 const int MAX_ITERATIONS = 1000;
 
+// A wheel tick zooms by ZOOM_STEP, an arrow key pans by PAN_STEP of the view
+const double ZOOM_STEP = 1.1;
+const double PAN_STEP = 0.1;
+
+// Keep complete frames in memory and in frame_cache/ (up to
+// FRAME_CACHE_DISK_BYTES), so a view seen before, also in an earlier run,
+// comes back without iterating. Frames are keyed by the exact view, so a
+// cached frame is the same picture a render would give.
+#define USE_FRAME_CACHE 1
+const size_t FRAME_CACHE_DISK_BYTES = size_t(2) << 30;
+
+// Stream the per-frame timings to frame_profile.csv and frame_profile.json
+// (Chrome trace). F shows them on screen either way.
+#define WRITE_FRAME_PROFILE 0
+
+// Julia set of the c under the mouse in a pane right of the view. It is
+// rendered on PREVIEW_THREADS cores taken from the main pool and fits each
+// frame into PREVIEW_BUDGET_MS by lowering its resolution and iterations.
+#define USE_JULIA_PREVIEW 1
+const int PREVIEW_SIZE = 400;
+const unsigned PREVIEW_THREADS = 2;
+const double PREVIEW_BUDGET_MS = 8.0;
+
+// While the workers are idle, render the views one wheel tick or arrow key
+// away, so the next step shows without a render. They go into a ring of
+// PREFETCH_FRAMES, and views the frame cache has are skipped.
+#define USE_PREFETCH 1
+const int PREFETCH_FRAMES = 8;
+
 sf::Color getColor(int iterations) {
     int r, g, b;
 
@@ -39,73 +67,129 @@ sf::Color getColor(int iterations) {
     return sf::Color(r, g, b);
 }
 
-std::complex<float> convertToComplex(int x, int y, float zoom, std::complex<float> move) {
-    float real = (x - WIDTH / 2.0f) / (0.5f * zoom * WIDTH) + move.real();
-    float imag = (y - HEIGHT / 2.0f) / (0.5f * zoom * HEIGHT) + move.imag();
-    return std::complex<float>(real, imag);
+sf::Color getColor2(int iterations) {
+    double t = (double)iterations / MAX_ITERATIONS;
+    int r = static_cast<int>((0.5 * sin(t * 3.14159) + 0.5) * 255);
+    int g = static_cast<int>((0.5 * cos(t * 3.14159) + 0.5) * 255);
+    int b = static_cast<int>(t * 255);
+    return sf::Color(r, g, b);
 }
 
-int mandelbrot(std::complex<float> c) {
-    std::complex<float> z(0, 0);
-    int iter = 0;
-
-    while (abs(z) < 2 && iter < MAX_ITERATIONS) {
-        z = z * z + c;
-        iter++;
+// Any of these will do for the overlay text; without one only the graph is drawn
+bool loadOverlayFont(sf::Font& font) {
+    const char* paths[] = {"/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf", "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
+                           "/System/Library/Fonts/Menlo.ttc", "C:/Windows/Fonts/consola.ttf"};
+    for (const char* path : paths) {
+        if (std::ifstream(path) && font.loadFromFile(path))
+            return true;
     }
-
-    return iter;
+    return false;
 }
 
-void computeMandelbrotSection(sf::Image& image, float zoom, std::complex<float> move, int startY, int endY) {
-    for (int x = 0; x < WIDTH; x++) {
-        for (int y = startY; y < endY; y++) {
-            std::complex<float> c = convertToComplex(x, y, zoom, move);
-            int value = mandelbrot(c);
-            sf::Color color = getColor(value);
-            image.setPixel(x, y, color);
+// Frame times of the recent frames as stacked bars, one color per phase, with
+// the numbers of the last frame next to them
+void drawOverlay(sf::RenderWindow& window, const FrameProfiler& profiler, const sf::Font* font) {
+    const float msHeight = 2.0f; // Pixels per millisecond
+    const float maxHeight = 250.0f;
+    const float barWidth = 3.0f;
+    const sf::Color colors[] = {sf::Color(80, 160, 255), sf::Color(255, 200, 60), sf::Color(255, 90, 90), sf::Color(120, 220, 120)};
+
+    sf::RectangleShape background(sf::Vector2f(120 * barWidth + 330, maxHeight + 20));
+    background.setPosition(0, 0);
+    background.setFillColor(sf::Color(0, 0, 0, 170));
+    window.draw(background);
+
+    float x = 10;
+    for (const FrameRecord& frame : profiler.getHistory()) {
+        float y = maxHeight + 10;
+        // Waiting for the workers is the bottom, grey segment
+        double segments[] = {frame.waitMs, frame.phase(FramePhase::Events), frame.phase(FramePhase::Color), frame.phase(FramePhase::Upload),
+                             frame.phase(FramePhase::Present)};
+        for (int i = 0; i < 5 && y > 10; i++) {
+            float height = std::min(static_cast<float>(segments[i]) * msHeight, y - 10);
+            sf::RectangleShape bar(sf::Vector2f(barWidth - 1, height));
+            bar.setPosition(x, y - height);
+            bar.setFillColor(i == 0 ? sf::Color(150, 150, 150) : colors[i - 1]);
+            window.draw(bar);
+            y -= height;
         }
+        x += barWidth;
     }
-}
 
-std::atomic<bool> redraw(false);
-std::atomic<bool> redrawRequested(false);
-
-void delayedRedraw(int delayInMilliseconds) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(delayInMilliseconds));
-    if (redrawRequested.load()) {
-        redraw.store(true);
-        redrawRequested.store(false);
+    if (font) {
+        sf::Text text;
+        text.setFont(*font);
+        text.setCharacterSize(13);
+        text.setFillColor(sf::Color::White);
+        text.setString(profiler.summary() + "\ngrey wait, blue events, yellow color, red upload, green present");
+        text.setPosition(120 * barWidth + 20, 10);
+        window.draw(text);
     }
 }
 
-void saveCoordinates(float zoom, std::complex<float> move, const std::string& filename) {
+void saveCoordinates(const Viewport& view, const std::string& filename) {
     std::ofstream outFile(filename);
     if (outFile) {
-        outFile << zoom << " " << move.real() << " " << move.imag() << std::endl;
+        outFile << view.zoom << " " << view.realString() << " " << view.imagString() << std::endl;
     }
     outFile.close();
 }
 
 int main(int argc, char* argv[]) {
-    sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "Mandelbrot Set");
-    sf::Image image;
-    image.create(WIDTH, HEIGHT, sf::Color(0, 0, 0));
+    sf::RenderWindow window(sf::VideoMode(WIDTH + (USE_JULIA_PREVIEW ? PREVIEW_SIZE : 0), HEIGHT), "Mandelbrot Set");
+    // The loop never waits for the engine, so the display paces it
+    window.setVerticalSyncEnabled(true);
     sf::Texture texture;
-    sf::Sprite sprite;
+    texture.create(WIDTH, HEIGHT);
+    sf::Sprite sprite(texture);
+
+    // P switches the palette, C cycles the colors
+    Palette<sf::Color> palettes[] = {Palette<sf::Color>(MAX_ITERATIONS, getColor), Palette<sf::Color>(MAX_ITERATIONS, getColor2)};
+    int paletteIndex = 0;
+
+    // Frames, the frame cache and prefetching all run on the engine's thread;
+    // this loop only hands it views and uploads the passes it finishes
+    EngineOptions options;
+    options.frameCache = USE_FRAME_CACHE;
+    options.cacheDirectory = "frame_cache";
+    options.cacheDiskBytes = FRAME_CACHE_DISK_BYTES;
+    options.prefetchFrames = USE_PREFETCH ? PREFETCH_FRAMES : 0;
+    options.zoomStep = ZOOM_STEP;
+    options.panStep = PAN_STEP;
+#if USE_JULIA_PREVIEW
+    // The preview gets the last cores to itself, so neither pool waits on the other
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    unsigned previewThreads = std::min(PREVIEW_THREADS, std::max(1u, cores - 1));
+    options.threads = std::max(1u, cores - previewThreads);
+    TileScheduler previewScheduler(previewThreads, options.tileSize, cores - previewThreads);
+#else
+    //options.threads = 1; // Number of threads to use
+#endif
+    RenderEngine<sf::Color> engine(WIDTH, HEIGHT, MAX_ITERATIONS, palettes[paletteIndex], options);
+
+#if USE_JULIA_PREVIEW
+    JuliaPreview<sf::Color> preview(previewScheduler, PREVIEW_SIZE, PREVIEW_SIZE, MAX_ITERATIONS, PREVIEW_BUDGET_MS);
+    sf::Texture previewTexture;
+    previewTexture.create(PREVIEW_SIZE, PREVIEW_SIZE);
+    sf::Sprite previewSprite(previewTexture);
+    previewSprite.setPosition(WIDTH, 0);
+    bool previewShown = false;
+#endif
 
-    float zoom = 1.0f;
-    std::complex<float> move(0, 0);
-    std::thread redrawThread;
-    redraw.store(true);
+    // F toggles the frame timing overlay
+    FrameProfiler profiler(WRITE_FRAME_PROFILE ? "frame_profile.csv" : "", WRITE_FRAME_PROFILE ? "frame_profile.json" : "");
+    bool showOverlay = false;
+    sf::Font font;
+    bool hasFont = loadOverlayFont(font);
 
     // Use zoom / pan from command-line argument
-    if (argc == 4) {
-        zoom = std::stof(argv[1]);
-        move = std::complex<float>(std::stof(argv[2]), std::stof(argv[3]));
-    }
+    Viewport view = argc == 4 ? Viewport(WIDTH, HEIGHT, std::stod(argv[1]), argv[2], argv[3]) : Viewport(WIDTH, HEIGHT);
+    engine.request(view);
 
     while (window.isOpen()) {
+        bool shown = false;
+        bool viewChanged = false;
+        auto eventTimer = profiler.scope(FramePhase::Events);
         sf::Event event;
         while (window.pollEvent(event)) {
             if (event.type == sf::Event::Closed) 
@@ -113,91 +197,156 @@ int main(int argc, char* argv[]) {
 
             // Handle zoom in and out
             if (event.type == sf::Event::MouseWheelMoved) {
-                if (event.mouseWheel.delta > 0) zoom *= 1.1f;
-                else zoom /= 1.1f;
-                redrawRequested.store(true);
+                if (event.mouseWheel.delta > 0) view.zoomBy(ZOOM_STEP);
+                else view.zoomBy(1 / ZOOM_STEP);
+                viewChanged = true;
             }
 
             // Handle pan
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left)) {
-                move -= std::complex<float>(0.1f / zoom, 0);
-                redrawRequested.store(true);
+                view.pan(-PAN_STEP / view.zoom, 0);
+                viewChanged = true;
             }
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right)) {
-                move += std::complex<float>(0.1f / zoom, 0);
-                redrawRequested.store(true);
+                view.pan(PAN_STEP / view.zoom, 0);
+                viewChanged = true;
             }
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up)) {
-                move -= std::complex<float>(0, 0.1f / zoom);
-                redrawRequested.store(true);
+                view.pan(0, -PAN_STEP / view.zoom);
+                viewChanged = true;
             }
             if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down)) {
-                move += std::complex<float>(0, 0.1f / zoom);
-                redrawRequested.store(true);
+                view.pan(0, PAN_STEP / view.zoom);
+                viewChanged = true;
+            }
+
+            // Recolor only
+            if (event.type == sf::Event::KeyPressed && (event.key.code == sf::Keyboard::P || event.key.code == sf::Keyboard::C)) {
+                if (event.key.code == sf::Keyboard::P) {
+                    paletteIndex = (paletteIndex + 1) % 2;
+                } else {
+                    palettes[paletteIndex].setCycle(palettes[paletteIndex].getCycle() + MAX_ITERATIONS / 50);
+                }
+                engine.setPalette(palettes[paletteIndex]);
+#if USE_JULIA_PREVIEW
+                if (previewShown)
+                    preview.request(preview.getReal(), preview.getImag());
+#endif
+            }
+
+#if USE_JULIA_PREVIEW
+            // Only the latest position is rendered, whatever the mouse passed
+            // over while the preview was busy
+            if (event.type == sf::Event::MouseMoved && event.mouseMove.x < WIDTH) {
+                double real = view.currentReal().get_d() + (event.mouseMove.x - WIDTH / 2.0) * view.pixelWidth();
+                double imag = view.currentImag().get_d() + (event.mouseMove.y - HEIGHT / 2.0) * view.pixelHeight();
+                preview.request(real, imag);
+            }
+#endif
+
+            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F) {
+                showOverlay = !showOverlay;
             }
 
             // Graceful exit
             if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape) {
                 window.close();
             }
+        }
 
-            // Check if a redraw is requested and if the thread is not already running
-            if (redrawRequested.load() && !redraw.load()) {
-                if (redrawThread.joinable()) {
-                    redrawThread.join(); // Ensure the previous thread is finished
-                }
-                redrawThread = std::thread(delayedRedraw, 1000); // Start a new thread for the delay
-            }
+        // A new view abandons the passes of the old one right away instead of
+        // waiting for the input to settle; the last frame stays until replaced
+        if (viewChanged)
+            engine.request(view);
+
+        eventTimer.stop();
+
+#if USE_JULIA_PREVIEW
+        // Never waits for the preview workers; a frame is picked up on the
+        // first turn of the loop after it is done
+        if (preview.update(palettes[paletteIndex])) {
+            auto timer = profiler.scope(FramePhase::Upload);
+            int frameWidth = preview.getFrameWidth(), frameHeight = preview.getFrameHeight();
+            previewTexture.update(reinterpret_cast<const sf::Uint8*>(preview.data()), frameWidth, frameHeight, 0, 0);
+            previewSprite.setTextureRect(sf::IntRect(0, 0, frameWidth, frameHeight));
+            previewSprite.setScale(static_cast<float>(PREVIEW_SIZE) / frameWidth, static_cast<float>(PREVIEW_SIZE) / frameHeight);
+            previewShown = true;
+            shown = true;
         }
+#endif
 
-        if (redraw.load()) {
-            //const int threadCount = 1; // Number of threads to use
-            unsigned int threadCount = std::thread::hardware_concurrency();
-            std::cout << "Using " << threadCount << " threads" << std::endl;
-#if USE_FUTURE
-            std::vector<std::future<void>> futures;
-
-            for (unsigned int i = 0; i < threadCount; ++i) {
-                int startY = i * HEIGHT / threadCount;
-                int endY = (i + 1) * HEIGHT / threadCount;
-                futures.emplace_back(std::async(std::launch::async, computeMandelbrotSection, std::ref(image), zoom, move, startY, endY));
+        // Never waits for the engine either: each pass, coarsest first, is
+        // shown on the first turn of the loop after it is done
+        if (engine.acquire()) {
+            {
+                // Only the tiles that changed since the last frame shown
+                auto timer = profiler.scope(FramePhase::Upload);
+                engine.upload([&](const sf::Color* tile, int width, int height, int x, int y) {
+                    texture.update(reinterpret_cast<const sf::Uint8*>(tile), width, height, x, y);
+                });
             }
-
-            for (auto& f : futures) {
-                f.get(); // Wait for all threads to complete
+            const FrameInfo& info = engine.getInfo();
+            for (const std::vector<WorkerStats>& stats : info.passStats) {
+                profiler.addWorkers(stats);
             }
-#else
-            std::vector<std::thread> threads;
-
-            // Divide the work among threads
-            for (int i = 0; i < threadCount; ++i) {
-                int startY = i * HEIGHT / threadCount;
-                int endY = (i + 1) * HEIGHT / threadCount;
-                threads.emplace_back(computeMandelbrotSection, std::ref(image), zoom, move, startY, endY);
+            profiler.addPhase(FramePhase::Color, info.colorMs);
+            profiler.addIterationTotals(info.iterations, info.pixels, info.maxIterationPixels);
+            shown = true;
+
+            if (info.complete && !info.recolored) {
+                if (info.source == FrameSource::Cached) {
+                    std::cout << "Frame cache: " << info.cacheHits << " hits (" << info.cacheDiskHits << " from disk), " << info.cacheMisses
+                              << " misses, " << info.cacheFrames << " frames in memory" << std::endl;
+                } else if (info.source == FrameSource::Prefetched) {
+                    std::cout << "Prefetched frame" << std::endl;
+                } else {
+                    std::cout << "Using " << engine.getThreadCount() << " threads, " << precisionName(info.precision) << " precision, "
+                              << info.renderedPixels << " of " << WIDTH * HEIGHT << " pixels rendered in " << info.renderMs << " ms" << std::endl;
+                }
+                if (!info.passStats.empty())
+                    printWorkerStats(info.passStats.back());
             }
+        }
 
-            // Join threads
-            for (auto& t : threads) {
-                t.join();
+        {
+            auto timer = profiler.scope(FramePhase::Present);
+            window.clear();
+            window.draw(sprite);
+#if USE_JULIA_PREVIEW
+            if (previewShown) {
+                window.draw(previewSprite);
+                if (hasFont) {
+                    std::ostringstream caption;
+                    caption.setf(std::ios::fixed);
+                    caption.precision(5);
+                    caption << "c = " << preview.getReal() << (preview.getImag() < 0 ? " - " : " + ") << std::abs(preview.getImag()) << "i\n";
+                    caption.precision(1);
+                    caption << preview.getStep() << "x" << preview.getStep() << " pixels, " << preview.getIterationCap() << " iterations, "
+                            << preview.getLastMs() << " ms\n" << preview.getDroppedFrames() << " frames over budget";
+                    sf::Text text;
+                    text.setFont(font);
+                    text.setCharacterSize(13);
+                    text.setFillColor(sf::Color::White);
+                    text.setString(caption.str());
+                    text.setPosition(WIDTH + 10, PREVIEW_SIZE + 10);
+                    window.draw(text);
+                }
             }
 #endif
-
-            texture.loadFromImage(image);
-            sprite.setTexture(texture);
-            redraw.store(false);
+            if (showOverlay)
+                drawOverlay(window, profiler, hasFont ? &font : nullptr);
+            window.display();
         }
-
-        window.clear();
-        window.draw(sprite);
-        window.display();
-    }
-
-    if (redrawThread.joinable()) {
-        redrawThread.join(); // Make sure to join the thread before exiting
+        profiler.endFrame(shown);
     }
 
+    // The last frame shown, whether or not the engine got further
+    std::vector<sf::Color> saved(WIDTH * HEIGHT);
+    engine.getPixels().copyTo(saved.data());
+    sf::Image image;
+    image.create(WIDTH, HEIGHT, reinterpret_cast<const sf::Uint8*>(saved.data()));
     image.saveToFile("mandelbrot_interactive.png");
-    saveCoordinates(zoom, move, "last_coordinates.txt");
+    saveCoordinates(view, "last_coordinates.txt");
 
     return 0;
 }
@@ -0,0 +1,508 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_X86 1
+#include <immintrin.h>
+#else
+#define KERNEL_X86 0
+#endif
+
+// Shared escape-time kernel for all the C++ programs.
+//
+// The kernel works on one row at a time: the caller fills in the real part of
+// each pixel (so every program keeps its own coordinate mapping) and gets back
+// the iteration count per pixel. mandelbrotPoints() takes an imaginary part
+// per pixel as well, for columns and other runs of points that are not rows.
+// Escape is tested with |z|^2 < 4 instead of abs(z) < 2, so there is no sqrt
+// in the loop.
+//
+// The AVX2 / AVX-512 versions iterate 4/8 (double) or 8/16 (float) pixels at
+// once and mask out lanes that have escaped. The widest ISA supported by the
+// CPU is picked at runtime, with a scalar fallback.
+//
+// Two shortcuts end interior points early. Points inside the main cardioid or
+// the period-2 bulb are recognised in closed form and never iterated, and
+// Brent-style cycle detection stops an orbit as soon as z repeats exactly.
+// A repeated z means the orbit can never escape, so both give the same counts
+// as running to maxIterations.
+//
+// The scalar kernel is a template on the number type, so it also runs with
+// DoubleDouble below for zooms past the reach of double. The SIMD kernels
+// exist for float and double only.
+
+enum class KernelIsa { Auto, Scalar, Avx2, Avx512 };
+
+struct KernelOptions {
+    bool interiorCheck = true;    // Main cardioid / period-2 bulb test
+    bool periodicityCheck = true; // Orbit cycle detection
+};
+
+// Used by mandelbrotRow() unless the caller passes its own options
+inline KernelOptions kernelOptions;
+
+// Unevaluated sum hi + lo of two doubles, giving about 106 bits of mantissa.
+// Slower than double by roughly an order of magnitude but still far cheaper
+// than arbitrary precision.
+struct DoubleDouble {
+    double hi, lo;
+
+    DoubleDouble(double hi = 0, double lo = 0) : hi(hi), lo(lo) {}
+
+    static DoubleDouble twoSum(double a, double b) {
+        double s = a + b;
+        double bb = s - a;
+        return DoubleDouble(s, (a - (s - bb)) + (b - bb));
+    }
+
+    static DoubleDouble quickTwoSum(double a, double b) {
+        double s = a + b;
+        return DoubleDouble(s, b - (s - a));
+    }
+
+    explicit operator double() const { return hi + lo; }
+};
+
+inline DoubleDouble operator+(const DoubleDouble& a, const DoubleDouble& b) {
+    DoubleDouble s = DoubleDouble::twoSum(a.hi, b.hi);
+    return DoubleDouble::quickTwoSum(s.hi, s.lo + a.lo + b.lo);
+}
+
+inline DoubleDouble operator-(const DoubleDouble& a) {
+    return DoubleDouble(-a.hi, -a.lo);
+}
+
+inline DoubleDouble operator-(const DoubleDouble& a, const DoubleDouble& b) {
+    return a + (-b);
+}
+
+inline DoubleDouble operator*(const DoubleDouble& a, const DoubleDouble& b) {
+    double p = a.hi * b.hi;
+    double e = std::fma(a.hi, b.hi, -p);
+    return DoubleDouble::quickTwoSum(p, e + a.hi * b.lo + a.lo * b.hi);
+}
+
+inline bool operator<(const DoubleDouble& a, const DoubleDouble& b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+inline bool operator>(const DoubleDouble& a, const DoubleDouble& b) {
+    return b < a;
+}
+
+inline bool operator==(const DoubleDouble& a, const DoubleDouble& b) {
+    return a.hi == b.hi && a.lo == b.lo;
+}
+
+// imag[i * imagStride] is the imaginary part of pixel i: a stride of 0 is a
+// row, 1 gives every pixel its own
+template <typename T>
+using MandelbrotRowFn = void (*)(const T* real, const T* imag, int imagStride, int count, int maxIterations, bool periodicity, int* iterations);
+
+template <typename T>
+inline bool inCardioidOrBulb(T real, T imag) {
+    T imag2 = imag * imag;
+    T xq = real - T(0.25);
+    T q = xq * xq + imag2;
+    if (q * (q + xq) < T(0.25) * imag2)
+        return true;
+    T xb = real + 1;
+    return xb * xb + imag2 < T(0.0625);
+}
+
+template <typename T>
+inline int mandelbrot(T real, T imag, int maxIterations, bool periodicity = false) {
+    T zr = 0, zi = 0;
+    T savedR = 0, savedI = 0;
+    int checkpoint = 1, sinceCheckpoint = 0;
+    int iter = 0;
+
+    while (zr * zr + zi * zi < 4 && iter < maxIterations) {
+        T zr2 = zr * zr;
+        T zi2 = zi * zi;
+        zi = 2 * zr * zi + imag;
+        zr = zr2 - zi2 + real;
+        iter++;
+
+        if (periodicity) {
+            if (zr == savedR && zi == savedI)
+                return maxIterations;
+            // Brent: move the saved point forward at power-of-two distances
+            if (++sinceCheckpoint == checkpoint) {
+                savedR = zr;
+                savedI = zi;
+                sinceCheckpoint = 0;
+                checkpoint *= 2;
+            }
+        }
+    }
+
+    return iter;
+}
+
+template <typename T>
+inline void mandelbrotRowScalar(const T* real, const T* imag, int imagStride, int count, int maxIterations, bool periodicity, int* iterations) {
+    for (int i = 0; i < count; i++) {
+        iterations[i] = mandelbrot(real[i], imag[i * imagStride], maxIterations, periodicity);
+    }
+}
+
+#if KERNEL_X86
+
+__attribute__((target("avx2")))
+inline void mandelbrotRowAvx2(const float* real, const float* imag, int imagStride, int count, int maxIterations, bool periodicity, int* iterations) {
+    const __m256 four = _mm256_set1_ps(4.0f);
+    const __m256 rowImag = _mm256_set1_ps(imag[0]);
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int i = 0; i < count; i += 8) {
+        int lanes = std::min(8, count - i);
+        alignas(32) float re[8] = {};
+        alignas(32) float im[8] = {};
+        alignas(32) int out[8];
+        std::copy(real + i, real + i + lanes, re);
+
+        __m256 cr = _mm256_load_ps(re);
+        __m256 ci = rowImag;
+        if (imagStride != 0) {
+            std::copy(imag + i, imag + i + lanes, im);
+            ci = _mm256_load_ps(im);
+        }
+        __m256 zr = _mm256_setzero_ps();
+        __m256 zi = _mm256_setzero_ps();
+        __m256i iter = _mm256_setzero_si256();
+        __m256 active = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), laneIndex));
+        __m256 cycled = _mm256_setzero_ps();
+        __m256 savedR = zr, savedI = zi;
+        int checkpoint = 1, sinceCheckpoint = 0;
+
+        for (int n = 0; n < maxIterations; n++) {
+            __m256 zr2 = _mm256_mul_ps(zr, zr);
+            __m256 zi2 = _mm256_mul_ps(zi, zi);
+            active = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_add_ps(zr2, zi2), four, _CMP_LT_OQ));
+            if (_mm256_movemask_ps(active) == 0)
+                break;
+
+            __m256 zrzi = _mm256_mul_ps(zr, zi);
+            zi = _mm256_add_ps(_mm256_add_ps(zrzi, zrzi), ci);
+            zr = _mm256_add_ps(_mm256_sub_ps(zr2, zi2), cr);
+            // Active lanes are all ones (-1), so subtracting counts them
+            iter = _mm256_sub_epi32(iter, _mm256_castps_si256(active));
+
+            if (periodicity) {
+                __m256 same = _mm256_and_ps(_mm256_cmp_ps(zr, savedR, _CMP_EQ_OQ), _mm256_cmp_ps(zi, savedI, _CMP_EQ_OQ));
+                same = _mm256_and_ps(same, active);
+                cycled = _mm256_or_ps(cycled, same);
+                active = _mm256_andnot_ps(same, active);
+                if (++sinceCheckpoint == checkpoint) {
+                    savedR = zr;
+                    savedI = zi;
+                    sinceCheckpoint = 0;
+                    checkpoint *= 2;
+                }
+            }
+        }
+
+        iter = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(iter), _mm256_castsi256_ps(_mm256_set1_epi32(maxIterations)), cycled));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out), iter);
+        std::copy(out, out + lanes, iterations + i);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void mandelbrotRowAvx2(const double* real, const double* imag, int imagStride, int count, int maxIterations, bool periodicity, int* iterations) {
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d rowImag = _mm256_set1_pd(imag[0]);
+    const __m256i laneIndex = _mm256_setr_epi64x(0, 1, 2, 3);
+
+    for (int i = 0; i < count; i += 4) {
+        int lanes = std::min(4, count - i);
+        alignas(32) double re[4] = {};
+        alignas(32) double im[4] = {};
+        alignas(32) long long out[4];
+        std::copy(real + i, real + i + lanes, re);
+
+        __m256d cr = _mm256_load_pd(re);
+        __m256d ci = rowImag;
+        if (imagStride != 0) {
+            std::copy(imag + i, imag + i + lanes, im);
+            ci = _mm256_load_pd(im);
+        }
+        __m256d zr = _mm256_setzero_pd();
+        __m256d zi = _mm256_setzero_pd();
+        __m256i iter = _mm256_setzero_si256();
+        __m256d active = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(lanes), laneIndex));
+        __m256d cycled = _mm256_setzero_pd();
+        __m256d savedR = zr, savedI = zi;
+        int checkpoint = 1, sinceCheckpoint = 0;
+
+        for (int n = 0; n < maxIterations; n++) {
+            __m256d zr2 = _mm256_mul_pd(zr, zr);
+            __m256d zi2 = _mm256_mul_pd(zi, zi);
+            active = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(zr2, zi2), four, _CMP_LT_OQ));
+            if (_mm256_movemask_pd(active) == 0)
+                break;
+
+            __m256d zrzi = _mm256_mul_pd(zr, zi);
+            zi = _mm256_add_pd(_mm256_add_pd(zrzi, zrzi), ci);
+            zr = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), cr);
+            iter = _mm256_sub_epi64(iter, _mm256_castpd_si256(active));
+
+            if (periodicity) {
+                __m256d same = _mm256_and_pd(_mm256_cmp_pd(zr, savedR, _CMP_EQ_OQ), _mm256_cmp_pd(zi, savedI, _CMP_EQ_OQ));
+                same = _mm256_and_pd(same, active);
+                cycled = _mm256_or_pd(cycled, same);
+                active = _mm256_andnot_pd(same, active);
+                if (++sinceCheckpoint == checkpoint) {
+                    savedR = zr;
+                    savedI = zi;
+                    sinceCheckpoint = 0;
+                    checkpoint *= 2;
+                }
+            }
+        }
+
+        iter = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(iter), _mm256_castsi256_pd(_mm256_set1_epi64x(maxIterations)), cycled));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out), iter);
+        for (int l = 0; l < lanes; l++) {
+            iterations[i + l] = static_cast<int>(out[l]);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void mandelbrotRowAvx512(const float* real, const float* imag, int imagStride, int count, int maxIterations, bool periodicity, int* iterations) {
+    const __m512 four = _mm512_set1_ps(4.0f);
+    const __m512 rowImag = _mm512_set1_ps(imag[0]);
+    const __m512i one = _mm512_set1_epi32(1);
+
+    for (int i = 0; i < count; i += 16) {
+        int lanes = std::min(16, count - i);
+        __mmask16 valid = static_cast<__mmask16>(lanes == 16 ? 0xFFFF : (1u << lanes) - 1);
+
+        __m512 cr = _mm512_maskz_loadu_ps(valid, real + i);
+        __m512 ci = imagStride != 0 ? _mm512_maskz_loadu_ps(valid, imag + i) : rowImag;
+        __m512 zr = _mm512_setzero_ps();
+        __m512 zi = _mm512_setzero_ps();
+        __m512i iter = _mm512_setzero_si512();
+        __mmask16 active = valid;
+        __mmask16 cycled = 0;
+        __m512 savedR = zr, savedI = zi;
+        int checkpoint = 1, sinceCheckpoint = 0;
+
+        for (int n = 0; n < maxIterations; n++) {
+            __m512 zr2 = _mm512_mul_ps(zr, zr);
+            __m512 zi2 = _mm512_mul_ps(zi, zi);
+            active = _mm512_mask_cmp_ps_mask(active, _mm512_add_ps(zr2, zi2), four, _CMP_LT_OQ);
+            if (active == 0)
+                break;
+
+            __m512 zrzi = _mm512_mul_ps(zr, zi);
+            zi = _mm512_add_ps(_mm512_add_ps(zrzi, zrzi), ci);
+            zr = _mm512_add_ps(_mm512_sub_ps(zr2, zi2), cr);
+            iter = _mm512_mask_add_epi32(iter, active, iter, one);
+
+            if (periodicity) {
+                __mmask16 same = _mm512_mask_cmp_ps_mask(active, zr, savedR, _CMP_EQ_OQ);
+                same = _mm512_mask_cmp_ps_mask(same, zi, savedI, _CMP_EQ_OQ);
+                cycled |= same;
+                active &= ~same;
+                if (++sinceCheckpoint == checkpoint) {
+                    savedR = zr;
+                    savedI = zi;
+                    sinceCheckpoint = 0;
+                    checkpoint *= 2;
+                }
+            }
+        }
+
+        iter = _mm512_mask_mov_epi32(iter, cycled, _mm512_set1_epi32(maxIterations));
+        _mm512_mask_storeu_epi32(iterations + i, valid, iter);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void mandelbrotRowAvx512(const double* real, const double* imag, int imagStride, int count, int maxIterations, bool periodicity, int* iterations) {
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512d rowImag = _mm512_set1_pd(imag[0]);
+    const __m512i one = _mm512_set1_epi64(1);
+
+    for (int i = 0; i < count; i += 8) {
+        int lanes = std::min(8, count - i);
+        __mmask8 valid = static_cast<__mmask8>((1u << lanes) - 1);
+
+        __m512d cr = _mm512_maskz_loadu_pd(valid, real + i);
+        __m512d ci = imagStride != 0 ? _mm512_maskz_loadu_pd(valid, imag + i) : rowImag;
+        __m512d zr = _mm512_setzero_pd();
+        __m512d zi = _mm512_setzero_pd();
+        __m512i iter = _mm512_setzero_si512();
+        __mmask8 active = valid;
+        __mmask8 cycled = 0;
+        __m512d savedR = zr, savedI = zi;
+        int checkpoint = 1, sinceCheckpoint = 0;
+
+        for (int n = 0; n < maxIterations; n++) {
+            __m512d zr2 = _mm512_mul_pd(zr, zr);
+            __m512d zi2 = _mm512_mul_pd(zi, zi);
+            active = _mm512_mask_cmp_pd_mask(active, _mm512_add_pd(zr2, zi2), four, _CMP_LT_OQ);
+            if (active == 0)
+                break;
+
+            __m512d zrzi = _mm512_mul_pd(zr, zi);
+            zi = _mm512_add_pd(_mm512_add_pd(zrzi, zrzi), ci);
+            zr = _mm512_add_pd(_mm512_sub_pd(zr2, zi2), cr);
+            iter = _mm512_mask_add_epi64(iter, active, iter, one);
+
+            if (periodicity) {
+                __mmask8 same = _mm512_mask_cmp_pd_mask(active, zr, savedR, _CMP_EQ_OQ);
+                same = _mm512_mask_cmp_pd_mask(same, zi, savedI, _CMP_EQ_OQ);
+                cycled |= same;
+                active &= ~same;
+                if (++sinceCheckpoint == checkpoint) {
+                    savedR = zr;
+                    savedI = zi;
+                    sinceCheckpoint = 0;
+                    checkpoint *= 2;
+                }
+            }
+        }
+
+        iter = _mm512_mask_mov_epi64(iter, cycled, _mm512_set1_epi64(maxIterations));
+
+        alignas(64) long long out[8];
+        _mm512_store_si512(out, iter);
+        for (int l = 0; l < lanes; l++) {
+            iterations[i + l] = static_cast<int>(out[l]);
+        }
+    }
+}
+
+#endif
+
+inline KernelIsa detectKernelIsa() {
+#if KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return KernelIsa::Avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return KernelIsa::Avx2;
+#endif
+    return KernelIsa::Scalar;
+}
+
+// Picks the row function for the requested ISA, falling back to the best one
+// the CPU actually supports.
+template <typename T>
+inline MandelbrotRowFn<T> selectMandelbrotRow(KernelIsa isa = KernelIsa::Auto) {
+    KernelIsa supported = detectKernelIsa();
+    if (isa == KernelIsa::Auto || static_cast<int>(isa) > static_cast<int>(supported))
+        isa = supported;
+
+#if KERNEL_X86
+    if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
+        if (isa == KernelIsa::Avx512)
+            return static_cast<MandelbrotRowFn<T>>(mandelbrotRowAvx512);
+        if (isa == KernelIsa::Avx2)
+            return static_cast<MandelbrotRowFn<T>>(mandelbrotRowAvx2);
+    }
+#endif
+    return mandelbrotRowScalar<T>;
+}
+
+inline const char* kernelIsaName(KernelIsa isa) {
+    switch (isa) {
+        case KernelIsa::Scalar: return "scalar";
+        case KernelIsa::Avx2: return "avx2";
+        case KernelIsa::Avx512: return "avx512";
+        default: return "auto";
+    }
+}
+
+// Iterates one row of pixels with the given kernel. With the interior check
+// on, pixels inside the cardioid or bulb are filled in directly and the rest
+// are packed together so the SIMD lanes stay full.
+template <typename T>
+inline void mandelbrotRow(MandelbrotRowFn<T> rowFn, const T* real, T imag, int count, int maxIterations, int* iterations, const KernelOptions& options) {
+    // The cardioid and bulb both lie within |imag| < 0.65
+    if (!options.interiorCheck || imag > T(0.65) || imag < T(-0.65)) {
+        rowFn(real, &imag, 0, count, maxIterations, options.periodicityCheck, iterations);
+        return;
+    }
+
+    thread_local std::vector<T> outsideReal;
+    thread_local std::vector<int> outsideIndex;
+    thread_local std::vector<int> outsideIterations;
+    outsideReal.clear();
+    outsideIndex.clear();
+
+    for (int i = 0; i < count; i++) {
+        if (inCardioidOrBulb(real[i], imag)) {
+            iterations[i] = maxIterations;
+        } else {
+            outsideReal.push_back(real[i]);
+            outsideIndex.push_back(i);
+        }
+    }
+
+    int outside = static_cast<int>(outsideIndex.size());
+    outsideIterations.resize(outside);
+    rowFn(outsideReal.data(), &imag, 0, outside, maxIterations, options.periodicityCheck, outsideIterations.data());
+    for (int i = 0; i < outside; i++) {
+        iterations[outsideIndex[i]] = outsideIterations[i];
+    }
+}
+
+// Iterates one row of pixels with the best kernel for this CPU.
+template <typename T>
+inline void mandelbrotRow(const T* real, T imag, int count, int maxIterations, int* iterations, const KernelOptions& options = kernelOptions) {
+    static const MandelbrotRowFn<T> rowFn = selectMandelbrotRow<T>();
+    mandelbrotRow(rowFn, real, imag, count, maxIterations, iterations, options);
+}
+
+// Iterates count pixels that each have their own imaginary part, packed the
+// same way as a row.
+template <typename T>
+inline void mandelbrotPoints(MandelbrotRowFn<T> rowFn, const T* real, const T* imag, int count, int maxIterations, int* iterations, const KernelOptions& options) {
+    if (count == 0)
+        return;
+    if (!options.interiorCheck) {
+        rowFn(real, imag, 1, count, maxIterations, options.periodicityCheck, iterations);
+        return;
+    }
+
+    thread_local std::vector<T> outsideReal;
+    thread_local std::vector<T> outsideImag;
+    thread_local std::vector<int> outsideIndex;
+    thread_local std::vector<int> outsideIterations;
+    outsideReal.clear();
+    outsideImag.clear();
+    outsideIndex.clear();
+
+    for (int i = 0; i < count; i++) {
+        if (inCardioidOrBulb(real[i], imag[i])) {
+            iterations[i] = maxIterations;
+        } else {
+            outsideReal.push_back(real[i]);
+            outsideImag.push_back(imag[i]);
+            outsideIndex.push_back(i);
+        }
+    }
+
+    int outside = static_cast<int>(outsideIndex.size());
+    outsideIterations.resize(outside);
+    if (outside > 0)
+        rowFn(outsideReal.data(), outsideImag.data(), 1, outside, maxIterations, options.periodicityCheck, outsideIterations.data());
+    for (int i = 0; i < outside; i++) {
+        iterations[outsideIndex[i]] = outsideIterations[i];
+    }
+}
+
+template <typename T>
+inline void mandelbrotPoints(const T* real, const T* imag, int count, int maxIterations, int* iterations, const KernelOptions& options = kernelOptions) {
+    static const MandelbrotRowFn<T> rowFn = selectMandelbrotRow<T>();
+    mandelbrotPoints(rowFn, real, imag, count, maxIterations, iterations, options);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+// Iteration count -> color lookup table.
+//
+// The color functions are evaluated once per possible iteration count instead
+// of once per pixel, so coloring a frame is one table lookup per pixel and
+// can be redone at any time from the stored iteration counts: switching the
+// palette or cycling the colors does not touch the escape-time kernel.
+//
+// Color is whatever the program writes out (sf::Color, RGB, ...).
+
+template <typename Color>
+class Palette {
+public:
+    Palette() = default;
+
+    template <typename ColorFn>
+    Palette(int maxIterations, ColorFn colorOf) {
+        build(maxIterations, colorOf);
+    }
+
+    // colorOf(n) is called for n = 0 .. maxIterations
+    template <typename ColorFn>
+    void build(int maxIterations, ColorFn colorOf) {
+        this->maxIterations = maxIterations;
+        colors.resize(maxIterations + 1);
+        for (int n = 0; n <= maxIterations; n++) {
+            colors[n] = colorOf(n);
+        }
+        setCycle(cycle);
+    }
+
+    int getMaxIterations() const { return maxIterations; }
+    int getCycle() const { return cycle; }
+
+    // Rotates the colors of escaping pixels by offset iterations. Pixels at
+    // maxIterations (the set) keep their color.
+    void setCycle(int offset) {
+        cycle = maxIterations > 0 ? ((offset % maxIterations) + maxIterations) % maxIterations : 0;
+        table.resize(colors.size());
+        for (int n = 0; n < maxIterations; n++) {
+            table[n] = colors[(n + cycle) % maxIterations];
+        }
+        table[maxIterations] = colors[maxIterations];
+    }
+
+    const Color& operator[](int iterations) const { return table[std::min(std::max(iterations, 0), maxIterations)]; }
+
+    // Colors count pixels. The iteration counts are sampled every step
+    // pixels, the pixels in between repeat the sample to their left.
+    void colorize(const int* iterations, int count, Color* out, int step = 1) const {
+        const Color* lut = table.data();
+        int top = maxIterations;
+
+        if (step == 1) {
+            for (int i = 0; i < count; i++) {
+                out[i] = lut[std::min(std::max(iterations[i], 0), top)];
+            }
+            return;
+        }
+
+        for (int x0 = 0; x0 < count; x0 += step) {
+            const Color& color = lut[std::min(std::max(iterations[x0], 0), top)];
+            std::fill(out + x0, out + std::min(x0 + step, count), color);
+        }
+    }
+
+private:
+    int maxIterations = 0;
+    int cycle = 0;
+    std::vector<Color> colors; // Unrotated
+    std::vector<Color> table;
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <gmpxx.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <string>
+#include <vector>
+
+// Perturbation-theory renderer for deep zooms (needs -lgmpxx -lgmp).
+//
+// Only one point per frame, the reference at the view center, is iterated in
+// arbitrary precision. Every pixel c = C + dc is then iterated as a double
+// delta against that reference orbit:
+//
+//     dz(n+1) = 2 Z(n) dz(n) + dz(n)^2 + dc
+//
+// which stays accurate because dc and dz are small numbers stored with their
+// own exponent. The first iterations are skipped with a cubic series
+// approximation dz(n) ~ A(n) dc + B(n) dc^2 + C(n) dc^3, valid while the cubic
+// term stays negligible for the corner pixels.
+//
+// Where a pixel's orbit passes close to zero (|Z + dz| < |dz|) the delta has
+// lost its precision relative to the reference; this is the classic
+// perturbation glitch. The pixel is then rebased: its full z becomes the new
+// delta against the start of the reference orbit, which is exact and needs no
+// second reference. The same happens when a pixel outlives the reference.
+//
+// Deltas are plain doubles, so this works down to pixel sizes around 1e-300.
+
+struct DeepView {
+    std::string centerReal; // Decimal strings, as many digits as needed
+    std::string centerImag;
+    double pixelWidth;      // Size of one pixel in the complex plane
+    double pixelHeight;
+    int width;
+    int height;
+    double offsetX = 0;     // View center in pixels from the reference point
+    double offsetY = 0;
+};
+
+class PerturbationFrame {
+public:
+    PerturbationFrame(const DeepView& view, int maxIterations) : view(view), maxIterations(maxIterations) {
+        computeReferenceOrbit();
+        computeSeriesApproximation();
+    }
+
+    // Iterates pixels x0, x0 + step, ... below x1 of row y into consecutive
+    // entries of iterations. Safe to call from several threads.
+    void iterateRow(int y, int x0, int x1, int* iterations, int step = 1) const {
+        double dci = (y + view.offsetY - view.height / 2.0) * view.pixelHeight;
+        for (int x = x0, i = 0; x < x1; x += step, i++) {
+            double dcr = (x + view.offsetX - view.width / 2.0) * view.pixelWidth;
+            iterations[i] = iteratePixel(std::complex<double>(dcr, dci));
+        }
+    }
+
+    // Iterates pixels y0 .. y1 - 1 of column x
+    void iterateColumn(int x, int y0, int y1, int* iterations) const {
+        double dcr = (x + view.offsetX - view.width / 2.0) * view.pixelWidth;
+        for (int y = y0; y < y1; y++) {
+            double dci = (y + view.offsetY - view.height / 2.0) * view.pixelHeight;
+            iterations[y - y0] = iteratePixel(std::complex<double>(dcr, dci));
+        }
+    }
+
+    int getReferenceLength() const { return static_cast<int>(orbit.size()) - 1; }
+    int getSkippedIterations() const { return skipped; }
+    long long getRebaseCount() const { return rebases.load(); }
+    int getPrecisionBits() const { return precisionBits; }
+
+private:
+    DeepView view;
+    int maxIterations;
+    int precisionBits = 64;
+
+    std::vector<std::complex<double>> orbit; // Z(0) .. Z(N), N = escape or maxIterations
+    int skipped = 0;
+    std::complex<double> seriesA, seriesB, seriesC;
+
+    mutable std::atomic<long long> rebases{0};
+
+    void computeReferenceOrbit() {
+        double pixel = std::min(view.pixelWidth, view.pixelHeight);
+        precisionBits = std::max(64, static_cast<int>(-std::log2(pixel)) + 64);
+
+        mpf_class cr(view.centerReal, precisionBits);
+        mpf_class ci(view.centerImag, precisionBits);
+        mpf_class zr(0, precisionBits), zi(0, precisionBits);
+        mpf_class zr2(0, precisionBits), zi2(0, precisionBits);
+
+        orbit.reserve(maxIterations + 1);
+        orbit.emplace_back(0.0, 0.0);
+        for (int n = 0; n < maxIterations; n++) {
+            zr2 = zr * zr;
+            zi2 = zi * zi;
+            if (zr2 + zi2 >= 4)
+                break;
+            zi = 2 * zr * zi + ci;
+            zr = zr2 - zi2 + cr;
+            orbit.emplace_back(zr.get_d(), zi.get_d());
+        }
+    }
+
+    void computeSeriesApproximation() {
+        double halfW = (view.width / 2.0 + std::abs(view.offsetX)) * view.pixelWidth;
+        double halfH = (view.height / 2.0 + std::abs(view.offsetY)) * view.pixelHeight;
+        double dcMax = std::sqrt(halfW * halfW + halfH * halfH);
+
+        std::complex<double> a(0, 0), b(0, 0), c(0, 0);
+        seriesA = a;
+        seriesB = b;
+        seriesC = c;
+        skipped = 0;
+
+        // Stop before the cubic term matters at the frame corners, and well
+        // before the reference escapes so rebasing still sees every step.
+        int limit = std::max(0, getReferenceLength() - 2);
+        for (int n = 0; n < limit; n++) {
+            std::complex<double> z2 = 2.0 * orbit[n];
+            std::complex<double> nextA = z2 * a + 1.0;
+            std::complex<double> nextB = z2 * b + a * a;
+            std::complex<double> nextC = z2 * c + 2.0 * a * b;
+
+            if (std::abs(nextC) * dcMax * dcMax > 1e-9 * std::abs(nextA))
+                break;
+
+            a = nextA;
+            b = nextB;
+            c = nextC;
+            seriesA = a;
+            seriesB = b;
+            seriesC = c;
+            skipped = n + 1;
+        }
+    }
+
+    int iteratePixel(std::complex<double> dc) const {
+        std::complex<double> dz0 = ((seriesC * dc + seriesB) * dc + seriesA) * dc;
+        double dzr = dz0.real(), dzi = dz0.imag();
+        double dcr = dc.real(), dci = dc.imag();
+        int refIndex = skipped;
+        int referenceLength = getReferenceLength();
+        int iter = skipped;
+        long long pixelRebases = 0;
+
+        while (iter < maxIterations) {
+            double zr = orbit[refIndex].real() + dzr;
+            double zi = orbit[refIndex].imag() + dzi;
+            double zNorm = zr * zr + zi * zi;
+            if (zNorm >= 4)
+                break;
+
+            if (zNorm < dzr * dzr + dzi * dzi || refIndex == referenceLength) {
+                dzr = zr;
+                dzi = zi;
+                refIndex = 0;
+                pixelRebases++;
+            }
+
+            // dz = 2 Z dz + dz^2 + dc
+            double Zr = orbit[refIndex].real(), Zi = orbit[refIndex].imag();
+            double nextR = 2 * (Zr * dzr - Zi * dzi) + (dzr * dzr - dzi * dzi) + dcr;
+            double nextI = 2 * (Zr * dzi + Zi * dzr) + 2 * dzr * dzi + dci;
+            dzr = nextR;
+            dzi = nextI;
+            refIndex++;
+            iter++;
+        }
+
+        if (pixelRebases > 0)
+            rebases.fetch_add(pixelRebases, std::memory_order_relaxed);
+        return iter;
+    }
+};
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_writer.hpp"
+#include "mandelbrot_kernel.hpp"
+#include "mandelbrot_palette.hpp"
+#include "mandelbrot_viewport.hpp"
+#include "tile_scheduler.hpp"
+
+// Offline renderer for images larger than memory. The image is cut into
+// tiles that are rendered in parallel and written straight into a tiled
+// BigTIFF, so memory stays at one tile per thread whatever the size.
+//
+// Finished tiles are recorded in a checkpoint file next to the output.
+// Running the same command again after an interruption only renders the
+// tiles that were not done yet.
+//
+// g++ -O2 -o mandelbrot_poster mandelbrot_poster.cpp -lgmpxx -lgmp -pthread && ./mandelbrot_poster
+// Size, then zoom / pan like in last_coordinates.txt:
+// g++ -O2 -o mandelbrot_poster mandelbrot_poster.cpp -lgmpxx -lgmp -pthread && ./mandelbrot_poster 100000 100000 1 -0.5 0
+
+const int TILE_SIZE = 256;
+const int MAX_ITERATIONS = 5000;
+const int CHECKPOINT_INTERVAL = 64; // Tiles between syncs of the output
+
+struct RGB {
+    unsigned char r, g, b;
+};
+
+RGB getColor(int iterations) {
+    RGB color;
+    double t = (double)iterations / MAX_ITERATIONS;
+
+    // Modify this color scheme as needed
+    color.r = static_cast<unsigned char>(9 * (1 - t) * t * t * t * 255);
+    color.g = static_cast<unsigned char>(15 * (1 - t) * (1 - t) * t * t * 255);
+    color.b = static_cast<unsigned char>(8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255);
+
+    return color;
+}
+
+// One byte per tile after a line describing the render. A tile is only
+// marked after the output has been synced, so a marked tile is always on
+// disk; tiles finished after the last sync are simply rendered again.
+class Checkpoint {
+public:
+    Checkpoint(const std::string& filename, const std::string& description, int tileCount)
+        : filename(filename), header(description + "\n"), done(tileCount, 0) {}
+
+    // Reads the finished tiles of an earlier run of the same render
+    bool load() {
+        std::ifstream in(filename, std::ios::binary);
+        std::string line;
+        if (!in || !std::getline(in, line) || line + "\n" != header)
+            return false;
+        in.read(reinterpret_cast<char*>(done.data()), static_cast<std::streamsize>(done.size()));
+        return in.gcount() == static_cast<std::streamsize>(done.size());
+    }
+
+    bool isDone(int tile) const { return done[tile] != 0; }
+
+    int getDoneCount() const { return static_cast<int>(std::count(done.begin(), done.end(), 1)); }
+
+    // Records finished tiles (call after the output was synced)
+    void mark(const std::vector<int>& tiles) {
+        for (int tile : tiles) {
+            done[tile] = 1;
+        }
+        // Written to a new file and renamed, so the old checkpoint stays
+        // intact if this is interrupted
+        std::string temporary = filename + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out << header;
+            out.write(reinterpret_cast<const char*>(done.data()), static_cast<std::streamsize>(done.size()));
+        }
+        std::rename(temporary.c_str(), filename.c_str());
+    }
+
+    void remove() { std::remove(filename.c_str()); }
+
+private:
+    std::string filename;
+    std::string header;
+    std::vector<unsigned char> done;
+};
+
+int main(int argc, char* argv[]) {
+    int width = argc >= 3 ? std::stoi(argv[1]) : 8192;
+    int height = argc >= 3 ? std::stoi(argv[2]) : 8192;
+    Viewport view = argc == 6 ? Viewport(width, height, std::stod(argv[3]), argv[4], argv[5]) : Viewport(width, height, 1.0, "-0.5", "0");
+    std::string filename = "mandelbrot_poster.tif";
+
+    // Zoom in hex so it round-trips exactly: two renders whose zooms differ
+    // in any bit must not share a checkpoint
+    std::ostringstream description;
+    description << "mandelbrot_poster " << width << " " << height << " " << TILE_SIZE << " " << MAX_ITERATIONS << " " << std::hexfloat << view.zoom
+                << std::defaultfloat << " " << view.realString() << " " << view.imagString();
+
+    TiledTiffWriter writer(filename, width, height, TILE_SIZE, true);
+    if (!writer.isGood())
+        return 1;
+
+    Checkpoint checkpoint(filename + ".checkpoint", description.str(), writer.getTileCount());
+    // The checkpoint only counts if the output it describes is still there
+    if (writer.isReused() && checkpoint.load()) {
+        std::cout << "Resuming: " << checkpoint.getDoneCount() << " of " << writer.getTileCount() << " tiles already done" << std::endl;
+    }
+
+    std::vector<Tile> tiles;
+    for (int ty = 0; ty < writer.getTilesY(); ty++) {
+        for (int tx = 0; tx < writer.getTilesX(); tx++) {
+            if (!checkpoint.isDone(ty * writer.getTilesX() + tx)) {
+                tiles.push_back({tx * TILE_SIZE, ty * TILE_SIZE, std::min((tx + 1) * TILE_SIZE, width), std::min((ty + 1) * TILE_SIZE, height)});
+            }
+        }
+    }
+
+    Palette<RGB> palette(MAX_ITERATIONS, getColor);
+    ViewportRenderer renderer;
+    renderer.beginFrame(view, MAX_ITERATIONS);
+    std::cout << "Rendering " << tiles.size() << " tiles of " << width << " x " << height << " at " << precisionName(renderer.getPrecision())
+              << " precision" << std::endl;
+
+    std::mutex finishedMutex;
+    std::vector<int> finished; // Written but not yet synced
+    std::atomic<int> rendered{0};
+
+    auto syncAndMark = [&]() {
+        std::vector<int> batch;
+        {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            batch.swap(finished);
+        }
+        if (!batch.empty() && writer.sync())
+            checkpoint.mark(batch);
+    };
+
+    TileScheduler scheduler;
+    auto start = std::chrono::steady_clock::now();
+    scheduler.submit(tiles, [&](const Tile& tile) {
+        thread_local std::vector<int> values;
+        thread_local std::vector<RGB> colors;
+        values.resize(TILE_SIZE);
+        // Edge tiles are padded with black
+        colors.assign(TILE_SIZE * TILE_SIZE, RGB{0, 0, 0});
+
+        for (int y = tile.y0; y < tile.y1; y++) {
+            renderer.iterateRow(y, tile.x0, tile.x1, values.data());
+            palette.colorize(values.data(), tile.x1 - tile.x0, &colors[(y - tile.y0) * TILE_SIZE]);
+        }
+
+        int tx = tile.x0 / TILE_SIZE, ty = tile.y0 / TILE_SIZE;
+        writer.writeTile(tx, ty, reinterpret_cast<const unsigned char*>(colors.data()));
+        rendered++;
+
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finished.push_back(ty * writer.getTilesX() + tx);
+    });
+
+    // Checkpoint and report progress while the workers run
+    int lastReported = -1;
+    while (!scheduler.isDone()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        bool due;
+        {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            due = finished.size() >= CHECKPOINT_INTERVAL;
+        }
+        if (due)
+            syncAndMark();
+
+        int percent = tiles.empty() ? 100 : static_cast<int>(100LL * rendered / tiles.size());
+        if (percent != lastReported) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "\r" << percent << "% (" << rendered << " of " << tiles.size() << " tiles, " << static_cast<int>(seconds) << " s)" << std::flush;
+            lastReported = percent;
+        }
+    }
+    auto stats = scheduler.wait();
+    syncAndMark();
+    std::cout << std::endl;
+    printWorkerStats(stats);
+
+    if (!writer.isGood()) {
+        std::cerr << "Could not write " << filename << "; run again to resume" << std::endl;
+        return 1;
+    }
+    checkpoint.remove();
+    std::cout << "Mandelbrot set image saved as " << filename << std::endl;
+
+    return 0;
+}
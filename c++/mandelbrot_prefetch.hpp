@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "mandelbrot_frame.hpp"
+#include "mandelbrot_viewport.hpp"
+#include "tile_scheduler.hpp"
+
+// Frames rendered ahead of time for the views the user is likely to go to
+// next (needs -lgmpxx -lgmp).
+//
+// Zooming and panning move in fixed steps, so from any view there are only a
+// handful of views one wheel tick or arrow key away. While the workers have
+// nothing else to do, the program renders those one at a time, at full
+// resolution, into a small ring of frames. A view found in the ring is shown
+// without iterating anything. A pan guess starts from the frame on screen,
+// shifted like IterationFrame shifts a pan, so only the exposed strip is
+// iterated; the zoom guesses are whole frames. The speculative frames only
+// use idle time: the one being rendered is cancelled as soon as a real
+// request comes in, and the workers drop it at the next row.
+
+// The views one zoom step in and out and one pan step in each direction away
+// from view, made the way the event loop makes them; most likely first
+inline std::vector<Viewport> likelyNextViews(const Viewport& view, double zoomStep, double panStep) {
+    std::vector<Viewport> views(6, view);
+    views[0].zoomBy(zoomStep);
+    views[1].zoomBy(1 / zoomStep);
+    views[2].pan(-panStep / view.zoom, 0);
+    views[3].pan(panStep / view.zoom, 0);
+    views[4].pan(0, -panStep / view.zoom);
+    views[5].pan(0, panStep / view.zoom);
+    return views;
+}
+
+class PrefetchRing {
+public:
+    PrefetchRing(int width, int height, int capacity = 8) {
+        for (int i = 0; i < capacity; i++) {
+            slots.emplace_back(new Slot(width, height));
+        }
+    }
+
+    // The iteration counts of a complete frame of view, or nullptr
+    const int* find(const Viewport& view, int maxIterations) const {
+        for (const auto& slot : slots) {
+            if (slot->ready && slot->maxIterations == maxIterations && sameView(slot->view, view))
+                return slot->frame.data();
+        }
+        return nullptr;
+    }
+
+    // Renders view into the oldest slot and blocks until it is done. With a
+    // complete frame of another view (from, fromCounts) on the same pixel
+    // grid, that frame is shifted and only the pixels it does not cover are
+    // iterated. Returns false if the scheduler or the optional cancel flag
+    // was cancelled; the slot is then dropped.
+    bool render(const Viewport& view, int maxIterations, const Viewport* from, const int* fromCounts, TileScheduler& scheduler,
+                std::vector<WorkerStats>& stats, const std::atomic<bool>* cancel = nullptr) {
+        Slot& slot = *slots[next];
+        next = (next + 1) % static_cast<int>(slots.size());
+
+        slot.ready = false;
+        if (from)
+            slot.frame.adopt(*from, renderer, maxIterations, fromCounts);
+        slot.frame.begin(view, renderer, maxIterations, scheduler.getTileSize());
+        while (slot.frame.hasPendingPass()) {
+            slot.frame.submitPass(scheduler, cancel);
+            if (!slot.frame.finishPass(scheduler, stats, cancel))
+                return false;
+        }
+        slot.view = view;
+        slot.maxIterations = maxIterations;
+        slot.ready = true;
+        return true;
+    }
+
+private:
+    struct Slot {
+        Slot(int width, int height) : frame(width, height) {}
+
+        Viewport view{0, 0};
+        int maxIterations = 0;
+        bool ready = false;
+        IterationFrame frame;
+    };
+
+    std::vector<std::unique_ptr<Slot>> slots;
+    int next = 0;
+    ViewportRenderer renderer;
+
+    static bool sameView(const Viewport& a, const Viewport& b) {
+        return a.sameGrid(b) && a.offsetX == b.offsetX && a.offsetY == b.offsetY;
+    }
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "tile_scheduler.hpp"
+
+// Mariani-Silver rectangle subdivision.
+//
+// The Mandelbrot set is connected and has no holes, and so are the bands of
+// equal iteration count around it. When every pixel on the border of a
+// rectangle has the same count, the pixels inside have it too and are filled
+// without being iterated. Otherwise the rectangle is cut into four along a
+// middle row and column, which are iterated, and each quarter is checked the
+// same way. Small rectangles are simply iterated.
+//
+// Inside the set this skips nearly everything, which is where the pixels at
+// MAX_ITERATIONS cost the most. Filaments thinner than a pixel can slip
+// between the border samples, so the result is not guaranteed to match a
+// brute-force render pixel for pixel.
+//
+// iterateRow(y, x0, x1, iterations) fills iterations[0 .. x1 - x0) with the
+// counts of pixels x0 .. x1 - 1 of row y, iterateColumn(x, y0, y1, iterations)
+// the same for a column. Columns are iterated as a batch, not pixel by pixel,
+// so they keep the SIMD lanes full. Tiles are independent, so each scheduler
+// tile is subdivided on its own worker.
+
+template <typename RowFn, typename ColumnFn>
+class TileSubdivider {
+public:
+    // iterations is the whole frame with rows of width pixels
+    TileSubdivider(int width, int* iterations, const RowFn& iterateRow, const ColumnFn& iterateColumn, int minSize = 8)
+        : width(width), iterations(iterations), iterateRow(iterateRow), iterateColumn(iterateColumn), minSize(std::max(3, minSize)) {}
+
+    // Renders tile, returns the number of pixels actually iterated
+    long long render(const Tile& tile) {
+        this->tile = tile;
+        tileWidth = tile.x1 - tile.x0;
+        done.assign(static_cast<size_t>(tileWidth) * (tile.y1 - tile.y0), 0);
+        iterated = 0;
+
+        int x1 = tile.x1 - 1, y1 = tile.y1 - 1;
+        computeRow(tile.y0, tile.x0, x1 + 1);
+        computeRow(y1, tile.x0, x1 + 1);
+        computeColumn(tile.x0, tile.y0, y1 + 1);
+        computeColumn(x1, tile.y0, y1 + 1);
+        subdivide(tile.x0, tile.y0, x1, y1);
+        return iterated;
+    }
+
+private:
+    int width;
+    int* iterations;
+    const RowFn& iterateRow;
+    const ColumnFn& iterateColumn;
+    int minSize;
+
+    Tile tile{};
+    int tileWidth = 0;
+    std::vector<char> done;
+    std::vector<int> column;
+    long long iterated = 0;
+
+    int& at(int x, int y) { return iterations[y * width + x]; }
+    char& isDone(int x, int y) { return done[(y - tile.y0) * tileWidth + (x - tile.x0)]; }
+
+    // Iterates the pixels of row y in [x0, x1) that are not known yet
+    void computeRow(int y, int x0, int x1) {
+        int x = x0;
+        while (x < x1) {
+            if (isDone(x, y)) {
+                x++;
+                continue;
+            }
+            int end = x;
+            while (end < x1 && !isDone(end, y)) {
+                isDone(end, y) = 1;
+                end++;
+            }
+            iterateRow(y, x, end, &at(x, y));
+            iterated += end - x;
+            x = end;
+        }
+    }
+
+    // Iterates the pixels of column x in [y0, y1) that are not known yet
+    void computeColumn(int x, int y0, int y1) {
+        int y = y0;
+        while (y < y1) {
+            if (isDone(x, y)) {
+                y++;
+                continue;
+            }
+            int end = y;
+            while (end < y1 && !isDone(x, end)) {
+                isDone(x, end) = 1;
+                end++;
+            }
+            column.resize(end - y);
+            iterateColumn(x, y, end, column.data());
+            for (int i = y; i < end; i++) {
+                at(x, i) = column[i - y];
+            }
+            iterated += end - y;
+            y = end;
+        }
+    }
+
+    // Border pixels of the inclusive rectangle, all known
+    bool uniformBorder(int x0, int y0, int x1, int y1, int& value) {
+        value = at(x0, y0);
+        for (int x = x0; x <= x1; x++) {
+            if (at(x, y0) != value || at(x, y1) != value)
+                return false;
+        }
+        for (int y = y0 + 1; y < y1; y++) {
+            if (at(x0, y) != value || at(x1, y) != value)
+                return false;
+        }
+        return true;
+    }
+
+    // The border of the inclusive rectangle (x0, y0) - (x1, y1) is known
+    void subdivide(int x0, int y0, int x1, int y1) {
+        if (x1 - x0 < 2 || y1 - y0 < 2)
+            return;
+
+        int value;
+        if (uniformBorder(x0, y0, x1, y1, value)) {
+            for (int y = y0 + 1; y < y1; y++) {
+                std::fill(&at(x0 + 1, y), &at(x1, y), value);
+                std::fill(&isDone(x0 + 1, y), &isDone(x1, y), 1);
+            }
+            return;
+        }
+
+        if (x1 - x0 < minSize || y1 - y0 < minSize) {
+            for (int y = y0 + 1; y < y1; y++) {
+                computeRow(y, x0 + 1, x1);
+            }
+            return;
+        }
+
+        int mx = (x0 + x1) / 2, my = (y0 + y1) / 2;
+        computeRow(my, x0 + 1, x1);
+        computeColumn(mx, y0 + 1, y1);
+
+        subdivide(x0, y0, mx, my);
+        subdivide(mx, y0, x1, my);
+        subdivide(x0, my, mx, y1);
+        subdivide(mx, my, x1, y1);
+    }
+};
+
+// Subdivides every tile on the scheduler. Returns the number of pixels
+// iterated; the rest were filled.
+template <typename RowFn, typename ColumnFn>
+long long renderSubdivided(TileScheduler& scheduler, int width, int height, int* iterations, const RowFn& iterateRow, const ColumnFn& iterateColumn) {
+    std::atomic<long long> iterated{0};
+    scheduler.run(width, height, [&](const Tile& tile) {
+        TileSubdivider<RowFn, ColumnFn> subdivider(width, iterations, iterateRow, iterateColumn);
+        iterated.fetch_add(subdivider.render(tile), std::memory_order_relaxed);
+    });
+    return iterated.load();
+}
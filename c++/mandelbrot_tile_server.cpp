@@ -0,0 +1,907 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "image_writer.hpp"
+#include "mandelbrot_palette.hpp"
+#include "mandelbrot_viewport.hpp"
+#include "tile_scheduler.hpp"
+
+// XYZ tile server for map viewers (POSIX only).
+//
+// Serves 256 x 256 PNG tiles at /z/x/y.png on 127.0.0.1, the layout web maps
+// use, e.g. in Leaflet: L.tileLayer('http://127.0.0.1:8080/{z}/{x}/{y}.png').
+// Zoom level 0 is one tile over real -2.5 .. 1.5 and imaginary -2 .. 2 (top
+// row first), every level splits each tile into four.
+//
+// The main thread runs a poll() loop over non-blocking sockets: it parses
+// requests, answers hot tiles from an LRU cache of encoded PNGs, and queues
+// the others for the render thread. A tile requested again while it is
+// queued or rendering does not get a second job; the request waits for the
+// first one. When the queue is full the server answers 503 instead of
+// piling up work it cannot finish in time.
+//
+// The render thread takes the queued tiles in batches, iterates them on the
+// shared scheduler side by side as one strip, then colors and encodes them in
+// parallel and hands the PNGs back to the main thread through a pipe.
+//
+// /stats returns the counters and the server-side latency as JSON.
+//
+// g++ -O2 -o mandelbrot_tile_server mandelbrot_tile_server.cpp -lgmpxx -lgmp -pthread && ./mandelbrot_tile_server 8080
+// Load test against a running server: port, connections, seconds; prints JSON
+// ./mandelbrot_tile_server load 8080 32 10
+// (wrk -c 32 -d 10 --latency http://127.0.0.1:8080/3/2/3.png measures a single hot tile)
+
+const int DEFAULT_PORT = 8080;
+const int TILE_SIZE = 256;
+const int MAX_ZOOM = 48;
+const int MAX_ITERATIONS = 2000;
+const size_t CACHE_BYTES = 256u << 20;   // Encoded PNGs kept in memory
+const size_t MAX_QUEUE = 256;            // Tiles waiting for the render thread
+const size_t RENDER_BATCH = 16;          // Tiles rendered together
+const int MAX_CONNECTIONS = 1024;
+const size_t MAX_REQUEST = 8192;         // Bytes of one request head
+const size_t MAX_PIPELINE = 8;           // Responses queued per connection
+const int IDLE_TIMEOUT_MS = 60000;       // Keep-alive connections
+const size_t LATENCY_SAMPLES = 4096;     // Latest tile requests in /stats
+const int LOAD_MAX_ZOOM = 12;            // Deepest level of the load test
+
+struct RGB {
+    unsigned char r, g, b;
+};
+
+RGB getColor(int iterations) {
+    RGB color;
+    double t = (double)iterations / MAX_ITERATIONS;
+
+    // Modify this color scheme as needed
+    color.r = static_cast<unsigned char>(9 * (1 - t) * t * t * t * 255);
+    color.g = static_cast<unsigned char>(15 * (1 - t) * (1 - t) * t * t * 255);
+    color.b = static_cast<unsigned char>(8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255);
+
+    return color;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Nearest-rank percentile
+double percentile(std::vector<double> values, double p) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+struct TileAddress {
+    int z;
+    long long x, y;
+
+    bool operator==(const TileAddress& other) const { return z == other.z && x == other.x && y == other.y; }
+};
+
+struct TileAddressHash {
+    size_t operator()(const TileAddress& tile) const {
+        uint64_t h = static_cast<uint64_t>(tile.x) * 0x9E3779B97F4A7C15ull;
+        h ^= static_cast<uint64_t>(tile.y) + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2);
+        return static_cast<size_t>(h ^ static_cast<uint64_t>(tile.z) << 58);
+    }
+};
+
+using Png = std::shared_ptr<const std::vector<unsigned char>>;
+
+// View of a tile; its pixel rows go up in the imaginary direction, so the
+// PNG is written bottom row first
+Viewport tileViewport(const TileAddress& tile) {
+    // The tile spans 4 / 2^z, i.e. 2 / zoom
+    double zoom = std::ldexp(0.5, tile.z);
+    Viewport view(TILE_SIZE, TILE_SIZE, zoom);
+    mpf_class span(4, view.centerReal.get_prec());
+    mpf_div_2exp(span.get_mpf_t(), span.get_mpf_t(), tile.z);
+    view.centerReal = mpf_class(-2.5, view.centerReal.get_prec()) + span * (static_cast<double>(tile.x) + 0.5);
+    view.centerImag = mpf_class(2.0, view.centerImag.get_prec()) - span * (static_cast<double>(tile.y) + 0.5);
+    return view;
+}
+
+// LRU of encoded tiles with a byte budget
+class PngCache {
+public:
+    explicit PngCache(size_t maxBytes) : maxBytes(maxBytes) {}
+
+    Png find(const TileAddress& tile) {
+        auto it = entries.find(tile);
+        if (it == entries.end())
+            return nullptr;
+        order.splice(order.begin(), order, it->second.position);
+        return it->second.png;
+    }
+
+    void insert(const TileAddress& tile, const Png& png) {
+        if (entries.count(tile) || png->size() > maxBytes)
+            return;
+        while (bytes + png->size() > maxBytes) {
+            auto last = entries.find(order.back());
+            bytes -= last->second.png->size();
+            entries.erase(last);
+            order.pop_back();
+        }
+        order.push_front(tile);
+        entries[tile] = {png, order.begin()};
+        bytes += png->size();
+    }
+
+    size_t getTileCount() const { return entries.size(); }
+    size_t getBytes() const { return bytes; }
+
+private:
+    struct Entry {
+        Png png;
+        std::list<TileAddress>::iterator position;
+    };
+
+    size_t maxBytes;
+    size_t bytes = 0;
+
+    // Most recently used first
+    std::list<TileAddress> order;
+    std::unordered_map<TileAddress, Entry, TileAddressHash> entries;
+};
+
+struct RenderedTile {
+    TileAddress tile;
+    Png png;
+};
+
+// Tiles between the main thread and the render thread, in both directions.
+// The main thread never blocks on it: tryPush() fails when the queue is full,
+// and finished tiles are announced on the pipe that poll() watches.
+class RenderQueue {
+public:
+    RenderQueue(size_t capacity, int wakeFd) : capacity(capacity), wakeFd(wakeFd) {}
+
+    bool tryPush(const TileAddress& tile) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (queued.size() >= capacity)
+            return false;
+        queued.push_back(tile);
+        ready.notify_one();
+        return true;
+    }
+
+    // Waits for work and takes up to count tiles; false after close()
+    bool popBatch(std::vector<TileAddress>& batch, size_t count) {
+        std::unique_lock<std::mutex> lock(mtx);
+        ready.wait(lock, [&]() { return !queued.empty() || closed; });
+        if (closed)
+            return false;
+        size_t n = std::min(count, queued.size());
+        batch.assign(queued.begin(), queued.begin() + n);
+        queued.erase(queued.begin(), queued.begin() + n);
+        return true;
+    }
+
+    void finish(std::vector<RenderedTile>& tiles, double renderMs) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (RenderedTile& tile : tiles) {
+                done.push_back(std::move(tile));
+            }
+            this->renderMs += renderMs;
+        }
+        char byte = 1;
+        ssize_t written = write(wakeFd, &byte, 1);
+        (void)written; // A full pipe already wakes the main thread
+    }
+
+    void takeFinished(std::vector<RenderedTile>& tiles, double& renderMs) {
+        std::lock_guard<std::mutex> lock(mtx);
+        tiles.swap(done);
+        done.clear();
+        renderMs = this->renderMs;
+    }
+
+    size_t getQueued() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return queued.size();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        ready.notify_all();
+    }
+
+private:
+    size_t capacity;
+    int wakeFd;
+    std::deque<TileAddress> queued;
+    std::vector<RenderedTile> done;
+    double renderMs = 0;
+    bool closed = false;
+    std::mutex mtx;
+    std::condition_variable ready;
+};
+
+// Renders batches of tiles until the queue is closed
+void renderLoop(RenderQueue& queue, TileScheduler& scheduler) {
+    Palette<RGB> palette(MAX_ITERATIONS, getColor);
+    std::vector<TileAddress> batch;
+    std::vector<ViewportRenderer> renderers;
+    std::vector<int> iterations;
+
+    while (queue.popBatch(batch, RENDER_BATCH)) {
+        auto start = Clock::now();
+        int count = static_cast<int>(batch.size());
+        renderers.resize(count);
+        iterations.resize(static_cast<size_t>(count) * TILE_SIZE * TILE_SIZE);
+        for (int i = 0; i < count; i++) {
+            renderers[i].beginFrame(tileViewport(batch[i]), MAX_ITERATIONS);
+        }
+
+        // The tiles sit side by side in one strip, so the scheduler splits
+        // them into its own small tiles and balances them like a frame
+        scheduler.run(count * TILE_SIZE, TILE_SIZE, [&](const Tile& rect) {
+            for (int y = rect.y0; y < rect.y1; y++) {
+                // A scheduler tile may straddle two map tiles
+                for (int x = rect.x0; x < rect.x1;) {
+                    int i = x / TILE_SIZE;
+                    int x0 = x % TILE_SIZE;
+                    int x1 = std::min(TILE_SIZE, x0 + (rect.x1 - x));
+                    renderers[i].iterateRow(y, x0, x1, &iterations[(static_cast<size_t>(i) * TILE_SIZE + y) * TILE_SIZE + x0]);
+                    x += x1 - x0;
+                }
+            }
+        });
+
+        // One encoder per tile
+        std::vector<RenderedTile> rendered(count);
+        std::vector<Tile> encodeTiles;
+        for (int i = 0; i < count; i++) {
+            encodeTiles.push_back({i, 0, i + 1, 1});
+        }
+        scheduler.run(encodeTiles, [&](const Tile& job) {
+            thread_local std::vector<RGB> rgb;
+            rgb.resize(TILE_SIZE * TILE_SIZE);
+            const int* tileIterations = &iterations[static_cast<size_t>(job.x0) * TILE_SIZE * TILE_SIZE];
+            for (int y = 0; y < TILE_SIZE; y++) {
+                palette.colorize(tileIterations + (TILE_SIZE - 1 - y) * TILE_SIZE, TILE_SIZE, &rgb[y * TILE_SIZE]);
+            }
+            static_assert(sizeof(RGB) == 3, "RGB must be packed");
+            auto png = std::make_shared<std::vector<unsigned char>>(PngEncoder::encode(TILE_SIZE, TILE_SIZE, &rgb[0].r));
+            rendered[job.x0] = {batch[job.x0], std::move(png)};
+        });
+
+        queue.finish(rendered, millisecondsSince(start));
+    }
+}
+
+struct Response {
+    std::string head;
+    Png body;       // May be null
+    size_t sent = 0; // Bytes of head and body
+};
+
+struct Connection {
+    int fd;
+    std::string input;
+    std::deque<Response> output;
+    bool waiting = false; // For a tile from the render thread
+    bool closeAfter = false;
+    bool peerClosed = false;
+    bool headOnly = false; // Of the request being waited for
+    Clock::time_point requestStart;
+    Clock::time_point lastActive;
+};
+
+struct Request {
+    std::string method;
+    std::string path;
+    bool keepAlive = true;
+    bool valid = false;
+};
+
+Request parseRequest(const std::string& head) {
+    Request request;
+    std::istringstream lines(head);
+    std::string line, version;
+    if (!std::getline(lines, line))
+        return request;
+    std::istringstream requestLine(line);
+    if (!(requestLine >> request.method >> request.path >> version) || version.compare(0, 5, "HTTP/") != 0)
+        return request;
+    request.keepAlive = version != "HTTP/1.0";
+    request.valid = true;
+
+    while (std::getline(lines, line)) {
+        std::string lower(line);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (lower.compare(0, 11, "connection:") == 0) {
+            if (lower.find("close") != std::string::npos)
+                request.keepAlive = false;
+            else if (lower.find("keep-alive") != std::string::npos)
+                request.keepAlive = true;
+        } else if (lower.compare(0, 15, "content-length:") == 0 && std::strtoll(lower.c_str() + 15, nullptr, 10) != 0) {
+            request.valid = false; // Tiles take no request body
+        } else if (lower.compare(0, 18, "transfer-encoding:") == 0) {
+            request.valid = false;
+        }
+    }
+    return request;
+}
+
+// Parses /z/x/y.png (a query string is ignored)
+bool parseTilePath(const std::string& path, TileAddress& tile) {
+    std::string clean = path.substr(0, path.find('?'));
+    long long z, x, y;
+    char extension[8] = {};
+    int consumed = 0;
+    if (std::sscanf(clean.c_str(), "/%lld/%lld/%lld.%4s%n", &z, &x, &y, extension, &consumed) != 4 || consumed != static_cast<int>(clean.size()) ||
+        std::strcmp(extension, "png") != 0)
+        return false;
+    if (z < 0 || z > MAX_ZOOM || x < 0 || y < 0 || x >= (1ll << z) || y >= (1ll << z))
+        return false;
+    tile = {static_cast<int>(z), x, y};
+    return true;
+}
+
+class TileServer {
+public:
+    TileServer(int listenFd, int wakeFd, RenderQueue& queue) : listenFd(listenFd), wakeFd(wakeFd), queue(queue), cache(CACHE_BYTES) {}
+
+    // Serves until stop is set
+    void run(const std::atomic<bool>& stop) {
+        std::vector<pollfd> fds;
+        std::vector<uint64_t> ids;
+        while (!stop) {
+            fds.clear();
+            ids.clear();
+            fds.push_back({wakeFd, POLLIN, 0});
+            bool accepting = connections.size() < MAX_CONNECTIONS;
+            if (accepting)
+                fds.push_back({listenFd, POLLIN, 0});
+            for (auto& entry : connections) {
+                Connection& connection = entry.second;
+                short events = 0;
+                if (!connection.peerClosed && connection.input.size() <= MAX_REQUEST)
+                    events |= POLLIN;
+                if (!connection.output.empty())
+                    events |= POLLOUT;
+                fds.push_back({connection.fd, events, 0});
+                ids.push_back(entry.first);
+            }
+
+            if (poll(fds.data(), fds.size(), 1000) < 0) {
+                if (errno == EINTR)
+                    continue;
+                std::cerr << "poll failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+
+            if (fds[0].revents & POLLIN)
+                collectRendered();
+            if (accepting && (fds[1].revents & POLLIN))
+                acceptConnections();
+
+            size_t first = accepting ? 2 : 1;
+            for (size_t i = 0; i < ids.size(); i++) {
+                short revents = fds[first + i].revents;
+                auto it = connections.find(ids[i]);
+                if (it == connections.end())
+                    continue;
+                if (revents & (POLLERR | POLLNVAL)) {
+                    closeConnection(it->first);
+                    continue;
+                }
+                if (revents & (POLLIN | POLLHUP))
+                    readInput(it->first, it->second);
+                else if (revents & POLLOUT)
+                    writeOutput(it->first, it->second);
+            }
+            closeIdle();
+        }
+    }
+
+    void printStats(std::ostream& out) { out << statsJson() << std::endl; }
+
+private:
+    int listenFd;
+    int wakeFd;
+    RenderQueue& queue;
+    PngCache cache;
+    std::unordered_map<uint64_t, Connection> connections;
+    uint64_t nextId = 1;
+
+    // Connections waiting for each queued or rendering tile
+    std::unordered_map<TileAddress, std::vector<uint64_t>, TileAddressHash> inFlight;
+
+    long long requests = 0;
+    long long tileRequests = 0;
+    long long cacheHits = 0;
+    long long deduplicated = 0;
+    long long rendered = 0;
+    long long rejected = 0;
+    long long errors = 0;
+    double renderMs = 0;
+    std::vector<double> latencyMs; // Ring of the latest tile requests
+    size_t latencyNext = 0;
+    Clock::time_point started = Clock::now();
+
+    void acceptConnections() {
+        while (connections.size() < MAX_CONNECTIONS) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+                return;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            Connection connection;
+            connection.fd = fd;
+            connection.lastActive = Clock::now();
+            connections.emplace(nextId++, std::move(connection));
+        }
+    }
+
+    void closeConnection(uint64_t id) {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        close(it->second.fd);
+        // A tile it waits for is still rendered and cached
+        connections.erase(it);
+    }
+
+    void closeIdle() {
+        std::vector<uint64_t> idle;
+        for (auto& entry : connections) {
+            const Connection& connection = entry.second;
+            if (!connection.waiting && connection.output.empty() &&
+                (connection.peerClosed || millisecondsSince(connection.lastActive) > IDLE_TIMEOUT_MS))
+                idle.push_back(entry.first);
+        }
+        for (uint64_t id : idle) {
+            closeConnection(id);
+        }
+    }
+
+    void readInput(uint64_t id, Connection& connection) {
+        char buffer[4096];
+        while (true) {
+            ssize_t n = recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                connection.input.append(buffer, n);
+                connection.lastActive = Clock::now();
+                if (connection.input.size() > MAX_REQUEST)
+                    break;
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                connection.peerClosed = true;
+            if (n < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        handleRequests(id, connection);
+    }
+
+    // Answers the buffered requests in order, one at a time while a tile is
+    // being rendered
+    void handleRequests(uint64_t id, Connection& connection) {
+        while (!connection.waiting && !connection.closeAfter && connection.output.size() < MAX_PIPELINE) {
+            size_t end = connection.input.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                if (connection.input.size() > MAX_REQUEST)
+                    respondText(connection, "400 Bad Request", "Request too large\n", false);
+                break;
+            }
+            Request request = parseRequest(connection.input.substr(0, end));
+            connection.input.erase(0, end + 4);
+            requests++;
+            handleRequest(id, connection, request);
+        }
+        if (!writeOutput(id, connection))
+            return;
+        if (connection.peerClosed && !connection.waiting && connection.output.empty())
+            closeConnection(id);
+    }
+
+    void handleRequest(uint64_t id, Connection& connection, const Request& request) {
+        if (!request.valid) {
+            respondText(connection, "400 Bad Request", "Bad request\n", false);
+            return;
+        }
+        bool headOnly = request.method == "HEAD";
+        if (request.method != "GET" && !headOnly) {
+            respondText(connection, "405 Method Not Allowed", "Only GET and HEAD\n", request.keepAlive);
+            return;
+        }
+        if (request.path == "/stats") {
+            respond(connection, "200 OK", "application/json", std::make_shared<std::vector<unsigned char>>(toBytes(statsJson() + "\n")), headOnly,
+                    request.keepAlive, "Cache-Control: no-store\r\n");
+            return;
+        }
+
+        TileAddress tile;
+        if (!parseTilePath(request.path, tile)) {
+            respondText(connection, "404 Not Found", "Tiles are at /z/x/y.png\n", request.keepAlive);
+            return;
+        }
+
+        tileRequests++;
+        connection.requestStart = Clock::now();
+        connection.closeAfter = !request.keepAlive;
+        if (Png png = cache.find(tile)) {
+            cacheHits++;
+            respondTile(connection, png, headOnly);
+            return;
+        }
+
+        auto waiters = inFlight.find(tile);
+        if (waiters != inFlight.end()) {
+            deduplicated++;
+            waiters->second.push_back(id);
+        } else if (queue.tryPush(tile)) {
+            inFlight[tile].push_back(id);
+        } else {
+            rejected++;
+            connection.closeAfter = false;
+            respondText(connection, "503 Service Unavailable", "Render queue full\n", request.keepAlive, "Retry-After: 1\r\n");
+            return;
+        }
+        connection.waiting = true;
+        connection.headOnly = headOnly;
+    }
+
+    void collectRendered() {
+        char buffer[256];
+        while (read(wakeFd, buffer, sizeof(buffer)) > 0) {
+        }
+
+        std::vector<RenderedTile> tiles;
+        queue.takeFinished(tiles, renderMs);
+        for (RenderedTile& result : tiles) {
+            rendered++;
+            cache.insert(result.tile, result.png);
+
+            auto waiters = inFlight.find(result.tile);
+            if (waiters == inFlight.end())
+                continue;
+            std::vector<uint64_t> ids;
+            ids.swap(waiters->second);
+            inFlight.erase(waiters);
+
+            for (uint64_t id : ids) {
+                auto it = connections.find(id);
+                if (it == connections.end())
+                    continue;
+                Connection& connection = it->second;
+                connection.waiting = false;
+                respondTile(connection, result.png, connection.headOnly);
+                // Pipelined requests that waited behind this one
+                handleRequests(id, connection);
+            }
+        }
+    }
+
+    void respondTile(Connection& connection, const Png& png, bool headOnly) {
+        double ms = millisecondsSince(connection.requestStart);
+        if (latencyMs.size() < LATENCY_SAMPLES)
+            latencyMs.push_back(ms);
+        else
+            latencyMs[latencyNext] = ms;
+        latencyNext = (latencyNext + 1) % LATENCY_SAMPLES;
+        respond(connection, "200 OK", "image/png", png, headOnly, !connection.closeAfter, "Cache-Control: public, max-age=86400\r\n");
+    }
+
+    void respondText(Connection& connection, const char* status, const std::string& text, bool keepAlive, const char* extraHeaders = "") {
+        errors++;
+        respond(connection, status, "text/plain", std::make_shared<std::vector<unsigned char>>(toBytes(text)), false, keepAlive, extraHeaders);
+    }
+
+    void respond(Connection& connection, const char* status, const char* contentType, const Png& body, bool headOnly, bool keepAlive,
+                 const char* extraHeaders) {
+        std::string head = std::string("HTTP/1.1 ") + status + "\r\nContent-Type: " + contentType + "\r\nContent-Length: " + std::to_string(body->size()) +
+                           "\r\nAccess-Control-Allow-Origin: *\r\n" + extraHeaders + (keepAlive ? "" : "Connection: close\r\n") + "\r\n";
+        connection.output.push_back({std::move(head), headOnly ? nullptr : body});
+        if (!keepAlive)
+            connection.closeAfter = true;
+    }
+
+    // Sends as much as the socket takes. Returns false if the connection was
+    // closed.
+    bool writeOutput(uint64_t id, Connection& connection) {
+        while (!connection.output.empty()) {
+            Response& response = connection.output.front();
+            size_t headSize = response.head.size();
+            size_t bodySize = response.body ? response.body->size() : 0;
+
+            iovec parts[2];
+            int count = 0;
+            if (response.sent < headSize)
+                parts[count++] = {&response.head[response.sent], headSize - response.sent};
+            if (bodySize > 0) {
+                size_t offset = response.sent > headSize ? response.sent - headSize : 0;
+                parts[count++] = {const_cast<unsigned char*>(response.body->data()) + offset, bodySize - offset};
+            }
+
+            ssize_t n = writev(connection.fd, parts, count);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return true;
+                closeConnection(id);
+                return false;
+            }
+            connection.lastActive = Clock::now();
+            response.sent += static_cast<size_t>(n);
+            if (response.sent == headSize + bodySize)
+                connection.output.pop_front();
+        }
+
+        if (connection.closeAfter && !connection.waiting) {
+            closeConnection(id);
+            return false;
+        }
+        // Requests that waited for room in the output; answering them may
+        // close the connection
+        if (!connection.waiting && connection.input.find("\r\n\r\n") != std::string::npos) {
+            handleRequests(id, connection);
+            return connections.count(id) > 0;
+        }
+        return true;
+    }
+
+    static std::vector<unsigned char> toBytes(const std::string& text) { return std::vector<unsigned char>(text.begin(), text.end()); }
+
+    std::string statsJson() {
+        std::ostringstream json;
+        json.precision(6);
+        double seconds = millisecondsSince(started) / 1000.0;
+        json << "{\"uptime_s\": " << seconds << ", \"requests\": " << requests << ", \"tile_requests\": " << tileRequests
+             << ", \"cache_hits\": " << cacheHits << ", \"deduplicated\": " << deduplicated << ", \"rendered\": " << rendered
+             << ", \"rejected\": " << rejected << ", \"errors\": " << errors << ", \"render_ms\": " << renderMs
+             << ", \"queued\": " << queue.getQueued() << ", \"in_flight\": " << inFlight.size() << ", \"connections\": " << connections.size()
+             << ", \"cache_tiles\": " << cache.getTileCount() << ", \"cache_bytes\": " << cache.getBytes()
+             << ", \"latency_p50_ms\": " << percentile(latencyMs, 50) << ", \"latency_p99_ms\": " << percentile(latencyMs, 99)
+             << ", \"latency_max_ms\": " << percentile(latencyMs, 100) << "}";
+        return json.str();
+    }
+};
+
+int connectLocal(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Sends GET path on a keep-alive connection and reads the response into body
+// if given. Returns the status code, or -1 if the connection failed.
+int fetch(int fd, const std::string& path, std::string& buffer, size_t& bodySize, std::string* body = nullptr) {
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+        return -1;
+
+    char chunk[65536];
+    size_t end;
+    while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return -1;
+        buffer.append(chunk, n);
+    }
+    int status = std::atoi(buffer.c_str() + 9);
+    std::string head = buffer.substr(0, end);
+    std::transform(head.begin(), head.end(), head.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    size_t length = head.find("content-length:");
+    bodySize = length == std::string::npos ? 0 : std::strtoull(head.c_str() + length + 15, nullptr, 10);
+
+    while (buffer.size() < end + 4 + bodySize) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return -1;
+        buffer.append(chunk, n);
+    }
+    if (body)
+        body->assign(buffer, end + 4, bodySize);
+    buffer.erase(0, end + 4 + bodySize);
+    return status;
+}
+
+// Clients that browse around a few spots at random depths, so low levels are
+// hot and deep tiles mostly need rendering, like traffic of a map viewer
+int runLoadTest(int port, int clients, double seconds) {
+    struct ClientResult {
+        std::vector<double> latencyMs;
+        long long ok = 0, rejected = 0, failed = 0, bytes = 0;
+    };
+    std::vector<ClientResult> results(clients);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+
+    for (int c = 0; c < clients; c++) {
+        threads.emplace_back([&, c]() {
+            const double spots[][2] = {{-0.7436, 0.1318}, {-1.25, 0.02}, {0.28, 0.0}, {-0.16, 1.04}};
+            std::mt19937 random(1234 + c);
+            ClientResult& result = results[c];
+            int fd = connectLocal(port);
+            std::string buffer;
+            while (Clock::now() < deadline) {
+                if (fd < 0) {
+                    result.failed++;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    fd = connectLocal(port);
+                    continue;
+                }
+                const double* spot = spots[random() % 4];
+                int z = static_cast<int>(random() % (LOAD_MAX_ZOOM + 1));
+                long long tiles = 1ll << z;
+                long long x = static_cast<long long>((spot[0] + 2.5) / 4.0 * tiles) + static_cast<long long>(random() % 3) - 1;
+                long long y = static_cast<long long>((2.0 - spot[1]) / 4.0 * tiles) + static_cast<long long>(random() % 3) - 1;
+                x = std::min(std::max(x, 0ll), tiles - 1);
+                y = std::min(std::max(y, 0ll), tiles - 1);
+
+                auto requestStart = Clock::now();
+                size_t bodySize = 0;
+                int status = fetch(fd, "/" + std::to_string(z) + "/" + std::to_string(x) + "/" + std::to_string(y) + ".png", buffer, bodySize);
+                if (status == 200) {
+                    result.latencyMs.push_back(millisecondsSince(requestStart));
+                    result.ok++;
+                    result.bytes += bodySize;
+                } else if (status == 503) {
+                    result.rejected++;
+                } else {
+                    result.failed++;
+                    close(fd);
+                    fd = -1;
+                    buffer.clear();
+                }
+            }
+            if (fd >= 0)
+                close(fd);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double elapsed = millisecondsSince(start) / 1000.0;
+
+    std::vector<double> latencyMs;
+    long long ok = 0, rejected = 0, failed = 0, bytes = 0;
+    for (const ClientResult& result : results) {
+        latencyMs.insert(latencyMs.end(), result.latencyMs.begin(), result.latencyMs.end());
+        ok += result.ok;
+        rejected += result.rejected;
+        failed += result.failed;
+        bytes += result.bytes;
+    }
+
+    std::string stats = "null";
+    int fd = connectLocal(port);
+    if (fd >= 0) {
+        std::string buffer, body;
+        size_t bodySize = 0;
+        if (fetch(fd, "/stats", buffer, bodySize, &body) == 200)
+            stats = body.substr(0, body.find_last_not_of('\n') + 1);
+        close(fd);
+    }
+
+    std::cout.precision(6);
+    std::cout << "{\n"
+              << "  \"clients\": " << clients << ",\n"
+              << "  \"seconds\": " << elapsed << ",\n"
+              << "  \"ok\": " << ok << ",\n"
+              << "  \"rejected\": " << rejected << ",\n"
+              << "  \"failed\": " << failed << ",\n"
+              << "  \"requests_per_s\": " << ok / elapsed << ",\n"
+              << "  \"mbytes_per_s\": " << bytes / elapsed / 1e6 << ",\n"
+              << "  \"latency_p50_ms\": " << percentile(latencyMs, 50) << ",\n"
+              << "  \"latency_p99_ms\": " << percentile(latencyMs, 99) << ",\n"
+              << "  \"latency_p999_ms\": " << percentile(latencyMs, 99.9) << ",\n"
+              << "  \"latency_max_ms\": " << percentile(latencyMs, 100) << ",\n"
+              << "  \"server\": " << stats << "\n"
+              << "}" << std::endl;
+    return failed > 0 && ok == 0 ? 1 : 0;
+}
+
+std::atomic<bool> stopRequested{false};
+int signalFd = -1;
+
+void onSignal(int) {
+    stopRequested = true;
+    char byte = 0;
+    ssize_t written = write(signalFd, &byte, 1);
+    (void)written;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "load") {
+        int port = argc >= 3 ? std::stoi(argv[2]) : DEFAULT_PORT;
+        int clients = argc >= 4 ? std::max(1, std::stoi(argv[3])) : 16;
+        double seconds = argc >= 5 ? std::stod(argv[4]) : 10.0;
+        return runLoadTest(port, clients, seconds);
+    }
+    int port = argc >= 2 ? std::stoi(argv[1]) : DEFAULT_PORT;
+
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Never reachable from outside
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+        std::cerr << "Could not listen on 127.0.0.1:" << port << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+    // The render thread and the signal handler wake poll() through the pipe
+    int wake[2];
+    if (pipe(wake) < 0) {
+        std::cerr << "Could not create pipe." << std::endl;
+        return 1;
+    }
+    for (int fd : wake) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    signalFd = wake[1];
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    TileScheduler scheduler;
+    RenderQueue queue(MAX_QUEUE, wake[1]);
+    std::thread renderThread(renderLoop, std::ref(queue), std::ref(scheduler));
+
+    std::cerr << "Serving tiles at http://127.0.0.1:" << port << "/{z}/{x}/{y}.png on " << scheduler.getThreadCount() << " render threads" << std::endl;
+    TileServer server(listenFd, wake[0], queue);
+    server.run(stopRequested);
+
+    queue.close();
+    renderThread.join();
+    server.printStats(std::cerr);
+    close(listenFd);
+    return 0;
+}
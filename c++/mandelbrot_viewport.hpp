@@ -0,0 +1,253 @@
+#pragma once
+
+#include <gmpxx.h>
+
+#include <cfloat>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mandelbrot_kernel.hpp"
+#include "mandelbrot_perturbation.hpp"
+
+// Viewport shared by the interactive programs, with an automatic precision
+// ladder (needs -lgmpxx -lgmp).
+//
+// The center is kept in arbitrary precision so panning stays exact at any
+// zoom. Each frame picks the cheapest number type that can still tell
+// neighbouring pixels apart:
+//
+//     Float        - full-width SIMD, shallow views
+//     Double       - SIMD at half the lanes
+//     DoubleDouble - scalar, ~106 bit mantissa
+//     Arbitrary    - perturbation against a GMP reference orbit
+//
+// The mapping is the one the interactive programs always used: the view spans
+// 2 / zoom in both directions. Panning moves the view by whole pixels away
+// from the grid anchor (centerReal, centerImag), so a pixel shared by two
+// frames of the same zoom gets exactly the same coordinate in both.
+
+enum class Precision { Auto, Float, Double, DoubleDouble, Arbitrary };
+
+inline const char* precisionName(Precision precision) {
+    switch (precision) {
+        case Precision::Float: return "float";
+        case Precision::Double: return "double";
+        case Precision::DoubleDouble: return "double-double";
+        case Precision::Arbitrary: return "arbitrary";
+        default: return "auto";
+    }
+}
+
+// A type is good enough while a pixel is still this many ulps of the
+// coordinates; below that the iteration amplifies the rounding into blocks.
+const double PRECISION_HEADROOM = 256.0;
+
+inline Precision selectPrecision(double pixelSize, double magnitude) {
+    double relative = pixelSize / std::max(magnitude, 1.0);
+    if (relative > FLT_EPSILON * PRECISION_HEADROOM)
+        return Precision::Float;
+    if (relative > DBL_EPSILON * PRECISION_HEADROOM)
+        return Precision::Double;
+    if (relative > DBL_EPSILON * DBL_EPSILON * PRECISION_HEADROOM)
+        return Precision::DoubleDouble;
+    return Precision::Arbitrary;
+}
+
+struct Viewport {
+    int width;
+    int height;
+    double zoom;
+    mpf_class centerReal; // Grid anchor
+    mpf_class centerImag;
+    long long offsetX = 0; // View center in pixels from the anchor
+    long long offsetY = 0;
+
+    Viewport(int width, int height, double zoom = 1.0, const std::string& real = "0", const std::string& imag = "0")
+        : width(width), height(height), zoom(zoom), centerReal(real, precisionBits(zoom)), centerImag(imag, precisionBits(zoom)) {}
+
+    Viewport(const Viewport& other) = default;
+
+    // mpf_class assignment keeps the target's precision, so carry it over first
+    Viewport& operator=(const Viewport& other) {
+        width = other.width;
+        height = other.height;
+        zoom = other.zoom;
+        offsetX = other.offsetX;
+        offsetY = other.offsetY;
+        centerReal.set_prec(other.centerReal.get_prec());
+        centerImag.set_prec(other.centerImag.get_prec());
+        centerReal = other.centerReal;
+        centerImag = other.centerImag;
+        return *this;
+    }
+
+    double pixelWidth() const { return 1.0 / (0.5 * zoom * width); }
+    double pixelHeight() const { return 1.0 / (0.5 * zoom * height); }
+
+    // Zooming starts a new pixel grid around the current center
+    void zoomBy(double factor) {
+        centerReal = currentReal();
+        centerImag = currentImag();
+        offsetX = 0;
+        offsetY = 0;
+        zoom *= factor;
+        centerReal.set_prec(precisionBits(zoom));
+        centerImag.set_prec(precisionBits(zoom));
+    }
+
+    // Moves the view by the nearest whole number of pixels
+    void pan(double real, double imag) {
+        offsetX += std::llround(real / pixelWidth());
+        offsetY += std::llround(imag / pixelHeight());
+    }
+
+    bool sameGrid(const Viewport& other) const {
+        return width == other.width && height == other.height && zoom == other.zoom &&
+               centerReal == other.centerReal && centerImag == other.centerImag;
+    }
+
+    mpf_class currentReal() const {
+        mpf_class real(centerReal);
+        real += static_cast<double>(offsetX) * pixelWidth();
+        return real;
+    }
+
+    mpf_class currentImag() const {
+        mpf_class imag(centerImag);
+        imag += static_cast<double>(offsetY) * pixelHeight();
+        return imag;
+    }
+
+    std::string realString() const { return toString(currentReal()); }
+    std::string imagString() const { return toString(currentImag()); }
+
+    static mp_bitcnt_t precisionBits(double zoom) {
+        return static_cast<mp_bitcnt_t>(std::max(64.0, std::log2(std::max(zoom, 1.0)) + 64.0));
+    }
+
+    static std::string toString(const mpf_class& value) {
+        std::ostringstream out;
+        out << std::setprecision(static_cast<int>(value.get_prec() * 0.30103) + 2) << value;
+        return out.str();
+    }
+};
+
+// Iterates rows of one viewport with the precision picked for it. beginFrame()
+// runs once per frame (it computes the reference orbit in arbitrary mode),
+// after which iterateRow() can be called from any number of threads.
+class ViewportRenderer {
+public:
+    void beginFrame(const Viewport& view, int maxIterations, Precision forced = Precision::Auto) {
+        this->maxIterations = maxIterations;
+        width = view.width;
+        height = view.height;
+        pixelWidth = view.pixelWidth();
+        pixelHeight = view.pixelHeight();
+
+        offsetX = static_cast<double>(view.offsetX);
+        offsetY = static_cast<double>(view.offsetY);
+
+        precision = forced != Precision::Auto ? forced : precisionFor(view);
+
+        centerReal = splitCenter(view.centerReal);
+        centerImag = splitCenter(view.centerImag);
+
+        deepFrame.reset();
+        if (precision == Precision::Arbitrary) {
+            // The reference stays on the anchor so panned frames share deltas
+            DeepView deepView{Viewport::toString(view.centerReal), Viewport::toString(view.centerImag), pixelWidth, pixelHeight, width, height, offsetX, offsetY};
+            deepFrame.reset(new PerturbationFrame(deepView, maxIterations));
+        }
+    }
+
+    Precision getPrecision() const { return precision; }
+
+    // The precision beginFrame() picks for view unless one is forced
+    static Precision precisionFor(const Viewport& view) {
+        double magnitude = std::max(std::abs(view.currentReal().get_d()), std::abs(view.currentImag().get_d()));
+        return selectPrecision(std::min(view.pixelWidth(), view.pixelHeight()), magnitude);
+    }
+
+    // Iterates pixels x0, x0 + step, ... below x1 of row y into consecutive
+    // entries of iterations.
+    void iterateRow(int y, int x0, int x1, int* iterations, int step = 1) const {
+        switch (precision) {
+            case Precision::Float: iterateRowAs<float>(y, x0, x1, iterations, step); break;
+            case Precision::DoubleDouble: iterateRowAs<DoubleDouble>(y, x0, x1, iterations, step); break;
+            case Precision::Arbitrary: deepFrame->iterateRow(y, x0, x1, iterations, step); break;
+            default: iterateRowAs<double>(y, x0, x1, iterations, step); break;
+        }
+    }
+
+    // Iterates pixels y0 .. y1 - 1 of column x
+    void iterateColumn(int x, int y0, int y1, int* iterations) const {
+        switch (precision) {
+            case Precision::Float: iterateColumnAs<float>(x, y0, y1, iterations); break;
+            case Precision::DoubleDouble: iterateColumnAs<DoubleDouble>(x, y0, y1, iterations); break;
+            case Precision::Arbitrary: deepFrame->iterateColumn(x, y0, y1, iterations); break;
+            default: iterateColumnAs<double>(x, y0, y1, iterations); break;
+        }
+    }
+
+private:
+    int maxIterations = 0;
+    int width = 0;
+    int height = 0;
+    double pixelWidth = 0;
+    double pixelHeight = 0;
+    double offsetX = 0;
+    double offsetY = 0;
+    Precision precision = Precision::Double;
+    DoubleDouble centerReal;
+    DoubleDouble centerImag;
+    std::unique_ptr<PerturbationFrame> deepFrame;
+
+    static DoubleDouble splitCenter(const mpf_class& value) {
+        double hi = value.get_d();
+        mpf_class rest = value - hi;
+        return DoubleDouble(hi, rest.get_d());
+    }
+
+    template <typename T>
+    static T toNumber(const DoubleDouble& value) {
+        if constexpr (std::is_same_v<T, DoubleDouble>)
+            return value;
+        else
+            return static_cast<T>(static_cast<double>(value));
+    }
+
+    template <typename T>
+    void iterateRowAs(int y, int x0, int x1, int* iterations, int step) const {
+        thread_local std::vector<T> real;
+        int count = (x1 - x0 + step - 1) / step;
+        real.resize(count);
+
+        T cr = toNumber<T>(centerReal);
+        for (int i = 0; i < count; i++) {
+            real[i] = cr + T((x0 + i * step + offsetX - width / 2.0) * pixelWidth);
+        }
+        T imag = toNumber<T>(centerImag) + T((y + offsetY - height / 2.0) * pixelHeight);
+
+        mandelbrotRow(real.data(), imag, count, maxIterations, iterations);
+    }
+
+    template <typename T>
+    void iterateColumnAs(int x, int y0, int y1, int* iterations) const {
+        thread_local std::vector<T> real;
+        thread_local std::vector<T> imag;
+        int count = y1 - y0;
+        real.assign(count, toNumber<T>(centerReal) + T((x + offsetX - width / 2.0) * pixelWidth));
+        imag.resize(count);
+
+        T ci = toNumber<T>(centerImag);
+        for (int i = 0; i < count; i++) {
+            imag[i] = ci + T((y0 + i + offsetY - height / 2.0) * pixelHeight);
+        }
+
+        mandelbrotPoints(real.data(), imag.data(), count, maxIterations, iterations);
+    }
+};
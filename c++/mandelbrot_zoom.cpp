@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mandelbrot_kernel.hpp"
+#include "mandelbrot_palette.hpp"
+#include "mandelbrot_viewport.hpp"
+#include "tile_scheduler.hpp"
+
+// Zoom animation renderer.
+//
+// The video zooms from START_ZOOM into a target point at a constant rate of
+// FRAMES_PER_OCTAVE frames per doubling of the zoom. Only one keyframe is
+// iterated per octave, at twice the video resolution; the frames in between
+// are scaled down from it, between 2:1 and 1:1, so they stay sharp.
+//
+// Each keyframe is centered on the target like the one before it at twice the
+// zoom, so a quarter of its pixels (every other pixel of every other row) are
+// exactly pixels of the previous keyframe and are copied instead of iterated.
+//
+// Rendering keyframes, coloring and scaling frames, and writing them run on
+// their own threads connected by bounded queues, so the workers keep
+// iterating the next keyframe while earlier frames are encoded and written.
+//
+// Output is a YUV4MPEG2 stream (or a stream of PPM images for a .ppm name),
+// to a file or, with "-", to stdout for piping into an encoder.
+//
+// g++ -O2 -o mandelbrot_zoom mandelbrot_zoom.cpp -lgmpxx -lgmp -pthread && ./mandelbrot_zoom - | ffmpeg -i - mandelbrot_zoom.mp4
+// Output file, then the target like in last_coordinates.txt (which is the default):
+// g++ -O2 -o mandelbrot_zoom mandelbrot_zoom.cpp -lgmpxx -lgmp -pthread && ./mandelbrot_zoom mandelbrot_zoom.y4m 26854.6 -1.24993 -0.0125627
+
+const int WIDTH = 1280;
+const int HEIGHT = 720;
+const int FPS = 30;
+const int FRAMES_PER_OCTAVE = 60;
+const double START_ZOOM = 0.5;
+const int MAX_ITERATIONS = 5000;
+const int KEYFRAME_QUEUE = 2; // Keyframes waiting to be colored
+const int FRAME_QUEUE = 16;   // Encoded frames waiting to be written
+
+struct RGB {
+    unsigned char r, g, b;
+};
+
+RGB getColor(int iterations) {
+    RGB color;
+    double t = (double)iterations / MAX_ITERATIONS;
+
+    // Modify this color scheme as needed
+    color.r = static_cast<unsigned char>(9 * (1 - t) * t * t * t * 255);
+    color.g = static_cast<unsigned char>(15 * (1 - t) * (1 - t) * t * t * 255);
+    color.b = static_cast<unsigned char>(8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255);
+
+    return color;
+}
+
+// Blocking queue with a fixed capacity between two pipeline stages. push()
+// waits while it is full, pop() while it is empty; after close() pop()
+// returns false once the queue is drained.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notFull.wait(lock, [&]() { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notEmpty.wait(lock, [&]() { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.erase(items.begin());
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::vector<T> items;
+    bool closed = false;
+    std::mutex mtx;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+struct Keyframe {
+    int index;
+    std::vector<int> iterations; // KEY_WIDTH x KEY_HEIGHT
+};
+
+const int KEY_WIDTH = 2 * WIDTH;
+const int KEY_HEIGHT = 2 * HEIGHT;
+
+// Iterates keyframe index, copying the pixels it shares with previous
+std::shared_ptr<Keyframe> renderKeyframe(int index, const std::string& real, const std::string& imag, const std::shared_ptr<const Keyframe>& previous,
+                                         TileScheduler& scheduler, ViewportRenderer& renderer, long long& iterated) {
+    auto keyframe = std::make_shared<Keyframe>();
+    keyframe->index = index;
+    keyframe->iterations.resize(static_cast<size_t>(KEY_WIDTH) * KEY_HEIGHT);
+
+    Viewport view(KEY_WIDTH, KEY_HEIGHT, START_ZOOM * std::pow(2.0, index), real, imag);
+    renderer.beginFrame(view, MAX_ITERATIONS);
+
+    // Pixel (x, y) with x - WIDTH and y - HEIGHT even is pixel
+    // ((x + WIDTH) / 2, (y + HEIGHT) / 2) of the previous keyframe
+    std::atomic<long long> count{0};
+    scheduler.run(KEY_WIDTH, KEY_HEIGHT, [&](const Tile& tile) {
+        thread_local std::vector<int> values;
+        values.resize(tile.x1 - tile.x0);
+        for (int y = tile.y0; y < tile.y1; y++) {
+            int* row = &keyframe->iterations[static_cast<size_t>(y) * KEY_WIDTH];
+            if (!previous || (y - HEIGHT) % 2 != 0) {
+                renderer.iterateRow(y, tile.x0, tile.x1, values.data());
+                std::copy(values.begin(), values.begin() + (tile.x1 - tile.x0), row + tile.x0);
+                count += tile.x1 - tile.x0;
+                continue;
+            }
+
+            const int* old = &previous->iterations[static_cast<size_t>((y + HEIGHT) / 2) * KEY_WIDTH];
+            int shared = tile.x0 + ((tile.x0 - WIDTH) % 2 != 0);
+            int fresh = tile.x0 + ((tile.x0 - WIDTH) % 2 == 0);
+            for (int x = shared; x < tile.x1; x += 2) {
+                row[x] = old[(x + WIDTH) / 2];
+            }
+            if (fresh < tile.x1) {
+                renderer.iterateRow(y, fresh, tile.x1, values.data(), 2);
+                for (int x = fresh, i = 0; x < tile.x1; x += 2, i++) {
+                    row[x] = values[i];
+                }
+                count += (tile.x1 - fresh + 1) / 2;
+            }
+        }
+    });
+    iterated = count;
+    return keyframe;
+}
+
+// Keyframe pixels under one frame pixel along an axis, each weighted by how
+// much of the frame pixel it covers. A frame pixel spans 1 to 2 keyframe
+// pixels, so it touches at most 3.
+struct Footprint {
+    int first;
+    int count;
+    double weight[3];
+};
+
+// Footprint of a frame pixel centered on keyframe position center; keyframe
+// pixel i covers [i - 0.5, i + 0.5)
+Footprint footprint(double center, double factor, int size) {
+    double lo = std::max(center - factor / 2, -0.5);
+    double hi = std::min(center + factor / 2, size - 0.5);
+    Footprint result;
+    result.first = static_cast<int>(std::floor(lo + 0.5));
+    result.count = 0;
+    double total = 0;
+    for (int i = result.first; i - 0.5 < hi && result.count < 3; i++) {
+        double weight = std::min(hi, i + 0.5) - std::max(lo, i - 0.5);
+        result.weight[result.count++] = weight;
+        total += weight;
+    }
+    for (int i = 0; i < result.count; i++) {
+        result.weight[i] /= total;
+    }
+    return result;
+}
+
+// Frame at scale 2^(step / FRAMES_PER_OCTAVE) of the keyframe. Each frame
+// pixel averages the keyframe pixels it covers (a box filter), so near 2:1
+// every keyframe pixel counts and the extra resolution anti-aliases.
+void scaleFrame(const std::vector<RGB>& key, int step, std::vector<RGB>& frame) {
+    double factor = 2.0 / std::pow(2.0, static_cast<double>(step) / FRAMES_PER_OCTAVE);
+    std::vector<Footprint> columns(WIDTH);
+    for (int x = 0; x < WIDTH; x++) {
+        columns[x] = footprint(WIDTH + (x - WIDTH / 2.0) * factor, factor, KEY_WIDTH);
+    }
+
+    for (int y = 0; y < HEIGHT; y++) {
+        Footprint row = footprint(HEIGHT + (y - HEIGHT / 2.0) * factor, factor, KEY_HEIGHT);
+        for (int x = 0; x < WIDTH; x++) {
+            const Footprint& column = columns[x];
+            double r = 0, g = 0, b = 0;
+            for (int j = 0; j < row.count; j++) {
+                const RGB* source = &key[static_cast<size_t>(row.first + j) * KEY_WIDTH + column.first];
+                for (int i = 0; i < column.count; i++) {
+                    double weight = row.weight[j] * column.weight[i];
+                    r += source[i].r * weight;
+                    g += source[i].g * weight;
+                    b += source[i].b * weight;
+                }
+            }
+            frame[y * WIDTH + x] = RGB{static_cast<unsigned char>(r + 0.5), static_cast<unsigned char>(g + 0.5), static_cast<unsigned char>(b + 0.5)};
+        }
+    }
+}
+
+// One YUV4MPEG2 frame: full-range BT.601 4:2:0, as C420jpeg declares
+std::vector<unsigned char> encodeY4m(const std::vector<RGB>& frame) {
+    const std::string header = "FRAME\n";
+    std::vector<unsigned char> out(header.begin(), header.end());
+    size_t lumaStart = out.size();
+    out.resize(lumaStart + WIDTH * HEIGHT + 2 * (WIDTH / 2) * (HEIGHT / 2));
+    unsigned char* luma = &out[lumaStart];
+    unsigned char* cb = luma + WIDTH * HEIGHT;
+    unsigned char* cr = cb + (WIDTH / 2) * (HEIGHT / 2);
+
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        luma[i] = static_cast<unsigned char>(0.299 * frame[i].r + 0.587 * frame[i].g + 0.114 * frame[i].b + 0.5);
+    }
+    for (int y = 0; y < HEIGHT / 2; y++) {
+        for (int x = 0; x < WIDTH / 2; x++) {
+            double r = 0, g = 0, b = 0;
+            for (int i : {2 * y * WIDTH + 2 * x, 2 * y * WIDTH + 2 * x + 1, (2 * y + 1) * WIDTH + 2 * x, (2 * y + 1) * WIDTH + 2 * x + 1}) {
+                r += frame[i].r / 4.0;
+                g += frame[i].g / 4.0;
+                b += frame[i].b / 4.0;
+            }
+            cb[y * (WIDTH / 2) + x] = static_cast<unsigned char>(std::min(255.0, std::max(0.0, 128 - 0.168736 * r - 0.331264 * g + 0.5 * b + 0.5)));
+            cr[y * (WIDTH / 2) + x] = static_cast<unsigned char>(std::min(255.0, std::max(0.0, 128 + 0.5 * r - 0.418688 * g - 0.081312 * b + 0.5)));
+        }
+    }
+    return out;
+}
+
+std::vector<unsigned char> encodePpm(const std::vector<RGB>& frame) {
+    std::string header = "P6\n" + std::to_string(WIDTH) + " " + std::to_string(HEIGHT) + "\n255\n";
+    std::vector<unsigned char> out(header.begin(), header.end());
+    const unsigned char* pixels = reinterpret_cast<const unsigned char*>(frame.data());
+    out.insert(out.end(), pixels, pixels + 3 * WIDTH * HEIGHT);
+    return out;
+}
+
+int main(int argc, char* argv[]) {
+    static_assert(WIDTH % 2 == 0 && HEIGHT % 2 == 0, "4:2:0 needs even dimensions");
+
+    std::string filename = argc >= 2 ? argv[1] : "mandelbrot_zoom.y4m";
+    double targetZoom = 468596;
+    std::string real = "-1.39535", imag = "-0.113084";
+    if (argc == 5) {
+        targetZoom = std::stod(argv[2]);
+        real = argv[3];
+        imag = argv[4];
+    } else {
+        std::ifstream in("last_coordinates.txt");
+        double zoom;
+        std::string fileReal, fileImag;
+        if (in >> zoom >> fileReal >> fileImag) {
+            targetZoom = zoom;
+            real = fileReal;
+            imag = fileImag;
+        }
+    }
+    bool ppm = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".ppm") == 0;
+
+    FILE* out = filename == "-" ? stdout : std::fopen(filename.c_str(), "wb");
+    if (!out) {
+        std::cerr << "Could not open file for writing." << std::endl;
+        return 1;
+    }
+
+    int frames = static_cast<int>(std::ceil(std::log2(targetZoom / START_ZOOM) * FRAMES_PER_OCTAVE)) + 1;
+    int keyframes = (frames - 1) / FRAMES_PER_OCTAVE + 1;
+    // stdout may be the video, so progress goes to stderr
+    std::cerr << frames << " frames, " << keyframes << " keyframes of " << KEY_WIDTH << " x " << KEY_HEIGHT << " to zoom " << targetZoom << " at " << real
+              << " " << imag << std::endl;
+
+    if (!ppm) {
+        std::string header = "YUV4MPEG2 W" + std::to_string(WIDTH) + " H" + std::to_string(HEIGHT) + " F" + std::to_string(FPS) + ":1 Ip A1:1 C420jpeg\n";
+        std::fwrite(header.data(), 1, header.size(), out);
+    }
+
+    BoundedQueue<std::shared_ptr<const Keyframe>> keyframeQueue(KEYFRAME_QUEUE);
+    BoundedQueue<std::vector<unsigned char>> frameQueue(FRAME_QUEUE);
+    auto start = std::chrono::steady_clock::now();
+
+    // Render stage: all workers on one keyframe at a time
+    std::thread renderThread([&]() {
+        TileScheduler scheduler;
+        ViewportRenderer renderer;
+        std::shared_ptr<const Keyframe> previous;
+        for (int k = 0; k < keyframes; k++) {
+            auto keyStart = std::chrono::steady_clock::now();
+            long long iterated = 0;
+            previous = renderKeyframe(k, real, imag, previous, scheduler, renderer, iterated);
+            std::cerr << "Keyframe " << k << " (" << precisionName(renderer.getPrecision()) << "): " << iterated << " of " << KEY_WIDTH * KEY_HEIGHT
+                      << " pixels iterated in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - keyStart).count() << " ms"
+                      << std::endl;
+            keyframeQueue.push(previous);
+        }
+        keyframeQueue.close();
+    });
+
+    // Color stage: colors each keyframe once and scales its frames out of it
+    std::thread colorThread([&]() {
+        Palette<RGB> palette(MAX_ITERATIONS, getColor);
+        std::vector<RGB> key(static_cast<size_t>(KEY_WIDTH) * KEY_HEIGHT);
+        std::vector<RGB> frame(WIDTH * HEIGHT);
+        std::shared_ptr<const Keyframe> keyframe;
+        while (keyframeQueue.pop(keyframe)) {
+            palette.colorize(keyframe->iterations.data(), KEY_WIDTH * KEY_HEIGHT, key.data());
+            int first = keyframe->index * FRAMES_PER_OCTAVE;
+            for (int i = first; i < std::min(first + FRAMES_PER_OCTAVE, frames); i++) {
+                scaleFrame(key, i - first, frame);
+                frameQueue.push(ppm ? encodePpm(frame) : encodeY4m(frame));
+            }
+        }
+        frameQueue.close();
+    });
+
+    // Write stage, here on the main thread
+    std::vector<unsigned char> encoded;
+    int written = 0;
+    bool good = true;
+    while (frameQueue.pop(encoded)) {
+        good = good && std::fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size();
+        written++;
+        if (written % FPS == 0 || written == frames) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cerr << "\r" << written << " of " << frames << " frames (" << written / seconds << " fps)" << std::flush;
+        }
+    }
+    std::cerr << std::endl;
+
+    renderThread.join();
+    colorThread.join();
+    good = std::fflush(out) == 0 && good;
+    if (out != stdout)
+        std::fclose(out);
+
+    if (!good) {
+        std::cerr << "Could not write " << filename << std::endl;
+        return 1;
+    }
+    std::cerr << "Zoom animation saved as " << filename << std::endl;
+
+    return 0;
+}
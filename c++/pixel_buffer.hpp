@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "tile_scheduler.hpp"
+
+// Frame of colored pixels stored tile by tile.
+//
+// Each tile of the scheduler grid has its own cache-line aligned block with
+// the rows of the tile packed together, so a worker coloring a tile writes
+// only memory no other worker touches, and the finished tile can be handed to
+// the GPU as is (sf::Texture::update(pixels, width, height, x, y)) without
+// copying it into a full-frame image first.
+//
+// Tiles are marked dirty when colored and flush() uploads the dirty ones, so
+// only what changed since the last flush is sent. A tile must not be colored
+// while it is being flushed: flush either while the workers are idle or while
+// they work on other tiles. A buffer handed to another thread instead gives
+// up its dirty tiles with takeDirty(), and the receiver uploads just those.
+
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    T* allocate(size_t count) { return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+template <typename Color>
+class TiledPixelBuffer {
+public:
+    static const size_t CACHE_LINE = 64;
+
+    TiledPixelBuffer(int width, int height, int tileSize)
+        : width(width), height(height), tileSize(tileSize), tilesX((width + tileSize - 1) / tileSize), tilesY((height + tileSize - 1) / tileSize),
+          slotSize(roundUp(static_cast<size_t>(tileSize) * tileSize, CACHE_LINE / std::min(sizeof(Color), CACHE_LINE))),
+          pixels(slotSize * tilesX * tilesY), dirty(new std::atomic<bool>[tilesX * tilesY]) {
+        for (int i = 0; i < tilesX * tilesY; i++) {
+            dirty[i].store(false);
+        }
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getTileSize() const { return tileSize; }
+    int getTileCount() const { return tilesX * tilesY; }
+
+    // Colors the part of the grid tile covered by tile (which must not cross
+    // grid tiles) from rows of iteration counts, sampled like
+    // Palette::colorize(). With step > 1 each step-th row is used for the rows
+    // below it; tile.x0 and tile.y0 must be multiples of step.
+    template <typename Palette>
+    void colorize(const Tile& tile, const int* iterations, int stride, int step, const Palette& palette) {
+        int index = tileIndex(tile.x0, tile.y0);
+        Tile grid = gridTile(index);
+        int gridWidth = grid.x1 - grid.x0;
+        Color* block = &pixels[index * slotSize];
+
+        for (int y = tile.y0; y < tile.y1; y++) {
+            const int* row = iterations + static_cast<size_t>(y & ~(step - 1)) * stride;
+            palette.colorize(row + tile.x0, tile.x1 - tile.x0, block + (y - grid.y0) * gridWidth + (tile.x0 - grid.x0), step);
+        }
+        dirty[index].store(true, std::memory_order_release);
+    }
+
+    // Calls upload(pixels, width, height, x, y) for each tile colored since
+    // the last flush. Returns the number of tiles uploaded.
+    template <typename UploadFn>
+    int flush(const UploadFn& upload) {
+        int count = 0;
+        for (int i = 0; i < tilesX * tilesY; i++) {
+            if (!dirty[i].exchange(false, std::memory_order_acquire))
+                continue;
+            Tile tile = gridTile(i);
+            upload(&pixels[i * slotSize], tile.x1 - tile.x0, tile.y1 - tile.y0, tile.x0, tile.y0);
+            count++;
+        }
+        return count;
+    }
+
+    // Appends the indices of the tiles colored since the last call (or flush)
+    // to tiles and marks them clean
+    void takeDirty(std::vector<int>& tiles) {
+        for (int i = 0; i < tilesX * tilesY; i++) {
+            if (dirty[i].exchange(false, std::memory_order_acquire))
+                tiles.push_back(i);
+        }
+    }
+
+    // Calls upload(pixels, width, height, x, y) for the tiles with the given
+    // indices, as from takeDirty()
+    template <typename UploadFn>
+    void upload(const std::vector<int>& tiles, const UploadFn& upload) const {
+        for (int i : tiles) {
+            Tile tile = gridTile(i);
+            upload(&pixels[i * slotSize], tile.x1 - tile.x0, tile.y1 - tile.y0, tile.x0, tile.y0);
+        }
+    }
+
+    // Copies tile index from a buffer of the same size, without marking it dirty
+    void copyTile(const TiledPixelBuffer& from, int index) {
+        std::copy_n(&from.pixels[index * slotSize], slotSize, &pixels[index * slotSize]);
+    }
+
+    // Row-major copy of the whole frame, e.g. for saving it
+    void copyTo(Color* out) const {
+        for (int i = 0; i < tilesX * tilesY; i++) {
+            Tile tile = gridTile(i);
+            int tileWidth = tile.x1 - tile.x0;
+            for (int y = tile.y0; y < tile.y1; y++) {
+                std::copy_n(&pixels[i * slotSize + (y - tile.y0) * tileWidth], tileWidth, out + y * width + tile.x0);
+            }
+        }
+    }
+
+private:
+    int width;
+    int height;
+    int tileSize;
+    int tilesX;
+    int tilesY;
+    size_t slotSize; // Pixels per tile, padded to whole cache lines
+    std::vector<Color, AlignedAllocator<Color, CACHE_LINE>> pixels;
+    std::unique_ptr<std::atomic<bool>[]> dirty;
+
+    static size_t roundUp(size_t value, size_t multiple) { return (value + multiple - 1) / multiple * multiple; }
+
+    int tileIndex(int x, int y) const { return (y / tileSize) * tilesX + x / tileSize; }
+
+    Tile gridTile(int index) const {
+        int x0 = (index % tilesX) * tileSize, y0 = (index / tilesX) * tileSize;
+        return {x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height)};
+    }
+};
@@ -0,0 +1,471 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mandelbrot_frame.hpp"
+#include "mandelbrot_frame_cache.hpp"
+#include "mandelbrot_palette.hpp"
+#include "mandelbrot_prefetch.hpp"
+#include "mandelbrot_viewport.hpp"
+#include "pixel_buffer.hpp"
+#include "tile_scheduler.hpp"
+
+// Renders viewports on a thread of its own (needs -lgmpxx -lgmp), so the UI
+// thread never waits for a frame and keeps drawing at display rate however
+// long one takes.
+//
+// The UI thread hands each new view over with request(), which publishes an
+// immutable copy of it and cancels whatever is being rendered, and new
+// colors with setPalette(). The engine thread takes the latest view and
+// renders it in the passes of IterationFrame, or takes it from the frame
+// cache or the prefetch ring when they are turned on. Reference orbits and
+// cache lookups happen on this thread, and the workers color each tile of a
+// pass into the back buffer (a TiledPixelBuffer) as soon as they have
+// iterated it. A pan moves the whole picture, so it is colored at once when
+// its strips are done.
+//
+// The back buffer of a finished pass is swapped with a hand-off slot in one
+// atomic exchange; acquire() on the UI thread swaps that slot with the front
+// buffer in the same way. Each frame numbers the tiles by the frame they last
+// changed in, so upload() sends only the tiles changed since the frame
+// uploaded before, however many frames the UI skipped. Tiles the back buffer
+// missed while the other two were drawn are copied over from the latest
+// frame first. No lock is held while rendering or uploading,
+// neither thread waits on the other, and the UI only ever sees whole passes:
+// the engine does not write a buffer again until acquire() has handed it
+// back.
+//
+// With nothing requested, the engine renders the views one zoom or pan step
+// away (see mandelbrot_prefetch.hpp), which any request or palette change
+// cancels at the next row.
+//
+// The engine owns its scheduler, renderer, frame and caches; the UI thread
+// only touches request(), setPalette(), acquire() and the front buffer.
+
+struct EngineOptions {
+    unsigned threads = std::thread::hardware_concurrency();
+    unsigned firstCore = 0;
+    int tileSize = 32;
+
+    // Keep complete frames and show a view seen before from them (see
+    // mandelbrot_frame_cache.hpp), with frames also kept in cacheDirectory
+    // unless that is empty
+    bool frameCache = false;
+    size_t cacheBytes = 512u << 20;
+    std::string cacheDirectory;
+    size_t cacheDiskBytes = size_t(1) << 30;
+
+    // Frames rendered ahead for the likely next views; 0 turns prefetching off
+    int prefetchFrames = 0;
+    double zoomStep = 1.1;
+    double panStep = 0.1;
+};
+
+enum class FrameSource { Passes, Cached, Prefetched };
+
+// What a frame buffer shows
+struct FrameInfo {
+    int step = 1;             // Pixel spacing of the samples
+    bool complete = false;    // Last pass of its view
+    bool recolored = false;   // Same counts as the frame before, new colors
+    FrameSource source = FrameSource::Passes;
+    Precision precision = Precision::Auto;
+    long long renderedPixels = 0; // Iterated for its view so far
+    double renderMs = 0;          // From taking the view until these counts were done
+    double colorMs = 0;           // Coloring since the frame acquired before, per worker
+
+    // One entry per pass finished since the frame acquired before, so none
+    // is lost when the UI skips a frame
+    std::vector<std::vector<WorkerStats>> passStats;
+
+    // Number of the frame, and per tile the number of the frame it last
+    // changed in
+    unsigned long long sequence = 0;
+    std::vector<unsigned long long> tileVersions;
+
+    // Over the samples shown
+    long long iterations = 0;
+    long long pixels = 0;
+    long long maxIterationPixels = 0;
+
+    // Frame cache counters, as of a frame from the cache
+    long long cacheHits = 0;
+    long long cacheDiskHits = 0;
+    long long cacheMisses = 0;
+    size_t cacheFrames = 0;
+};
+
+template <typename Color>
+class RenderEngine {
+public:
+    RenderEngine(int width, int height, int maxIterations, const Palette<Color>& palette, const EngineOptions& options = EngineOptions())
+        : width(width), height(height), maxIterations(maxIterations), options(options), palette(palette),
+          scheduler(options.threads, options.tileSize, options.firstCore), frame(width, height),
+          cache(options.cacheBytes, options.frameCache ? options.cacheDirectory : "", options.cacheDiskBytes),
+          prefetch(width, height, std::max(1, options.prefetchFrames)) {
+        buffers.reserve(3);
+        for (int i = 0; i < 3; i++) {
+            buffers.emplace_back(width, height, scheduler.getTileSize());
+        }
+        tileVersions.resize(buffers[0].pixels.getTileCount());
+        thread = std::thread(&RenderEngine::renderThread, this);
+    }
+
+    ~RenderEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+            cancelRender.store(true);
+            cancelGuess.store(true);
+        }
+        wakeup.notify_one();
+        thread.join();
+    }
+
+    RenderEngine(const RenderEngine&) = delete;
+    RenderEngine& operator=(const RenderEngine&) = delete;
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    unsigned getThreadCount() const { return scheduler.getThreadCount(); }
+
+    // Replaces the view being rendered; returns immediately
+    void request(const Viewport& view) {
+        std::atomic_store(&requestedView, std::make_shared<const Viewport>(view));
+        {
+            // The flags change under the lock, so the engine cannot clear a
+            // cancel meant for the work it is about to start
+            std::lock_guard<std::mutex> lock(mtx);
+            viewRequested = true;
+            cancelRender.store(true);
+            cancelGuess.store(true);
+        }
+        wakeup.notify_one();
+    }
+
+    // Recolors the current frame; a frame being rendered takes the colors
+    // from its next pass on. Returns immediately.
+    void setPalette(const Palette<Color>& next) {
+        std::atomic_store(&requestedPalette, std::make_shared<const Palette<Color>>(next));
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            paletteRequested = true;
+            cancelGuess.store(true);
+        }
+        wakeup.notify_one();
+    }
+
+    // Takes the latest finished pass as the front buffer. False if none was
+    // finished since the last call; the front buffer then stays as it was.
+    bool acquire() {
+        if (!(ready.load(std::memory_order_acquire) & FRESH))
+            return false;
+        front = ready.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+
+    // Calls upload(pixels, width, height, x, y) for each tile of the front
+    // buffer that changed since the last call. Returns the number of tiles.
+    template <typename UploadFn>
+    int upload(const UploadFn& upload) {
+        const Buffer& shown = buffers[front];
+        std::vector<int> tiles;
+        for (size_t i = 0; i < shown.info.tileVersions.size(); i++) {
+            if (shown.info.tileVersions[i] > uploadedSequence)
+                tiles.push_back(static_cast<int>(i));
+        }
+        shown.pixels.upload(tiles, upload);
+        uploadedSequence = shown.info.sequence;
+        return static_cast<int>(tiles.size());
+    }
+
+    // The front buffer, e.g. for saving it
+    const TiledPixelBuffer<Color>& getPixels() const { return buffers[front].pixels; }
+    const FrameInfo& getInfo() const { return buffers[front].info; }
+
+private:
+    // Set in ready while the buffer it names was not acquired yet
+    static const int FRESH = 4;
+
+    struct Buffer {
+        Buffer(int width, int height, int tileSize) : pixels(width, height, tileSize), stale(pixels.getTileCount()) {}
+
+        TiledPixelBuffer<Color> pixels;
+        std::vector<char> stale; // Tiles behind the latest frame; engine thread only
+        FrameInfo info;
+    };
+
+    int width;
+    int height;
+    int maxIterations;
+    EngineOptions options;
+
+    // Engine thread only
+    Palette<Color> palette;
+    TileScheduler scheduler;
+    ViewportRenderer renderer;
+    IterationFrame frame;
+    Viewport frameView{0, 0};    // What frame holds, while frameComplete
+    bool frameComplete = false;
+    FrameCache cache;
+    PrefetchRing prefetch;
+    std::vector<Viewport> guesses;
+    size_t nextGuess = 0;
+    const int* shownCounts = nullptr; // Counts of the last frame handed over, for recoloring
+    FrameInfo shownInfo;
+
+    // Summed by the workers over the samples they color
+    std::atomic<long long> colorNs{0};
+    std::atomic<long long> iterationSum{0};
+    std::atomic<long long> sampleCount{0};
+    std::atomic<long long> maxIterationSamples{0};
+
+    std::vector<Buffer> buffers;
+    std::vector<unsigned long long> tileVersions; // Engine thread only
+    unsigned long long sequence = 0;              // Engine thread only
+    unsigned long long uploadedSequence = 0;      // UI thread only
+    int front = 0;              // UI thread only
+    std::atomic<int> ready{1};  // Hand-off slot, plus FRESH
+    int back = 2;               // Engine thread only
+    int latest = -1;            // Buffer of the last frame handed over
+    bool backUnseen = false;    // The back buffer came back without being acquired
+
+    std::shared_ptr<const Viewport> requestedView;
+    std::shared_ptr<const Palette<Color>> requestedPalette;
+    std::atomic<bool> cancelRender{false}; // Set by request()
+    std::atomic<bool> cancelGuess{false};  // Set by request() and setPalette()
+    std::mutex mtx;
+    std::condition_variable wakeup;
+    bool viewRequested = false;
+    bool paletteRequested = false;
+    bool stopping = false;
+
+    std::thread thread;
+
+    void renderThread() {
+        while (true) {
+            bool newView;
+            bool newPalette;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                wakeup.wait(lock, [&]() { return stopping || viewRequested || paletteRequested || nextGuess < guesses.size(); });
+                if (stopping)
+                    return;
+                newView = viewRequested;
+                newPalette = paletteRequested;
+                viewRequested = false;
+                paletteRequested = false;
+                cancelRender.store(false);
+                cancelGuess.store(false);
+            }
+
+            if (newPalette)
+                palette = *std::atomic_load(&requestedPalette);
+            if (newView) {
+                render(*std::atomic_load(&requestedView));
+            } else if (newPalette) {
+                if (shownCounts) {
+                    FrameInfo info = shownInfo;
+                    info.recolored = true;
+                    info.passStats.clear();
+                    colorAll(shownCounts, info.step);
+                    publish(shownCounts, info);
+                }
+            } else {
+                guess();
+            }
+        }
+    }
+
+    void render(const Viewport& view) {
+        auto start = std::chrono::steady_clock::now();
+        auto elapsedMs = [&]() { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+        shownCounts = nullptr;
+        discardColoring();
+        guesses = options.prefetchFrames > 0 ? likelyNextViews(view, options.zoomStep, options.panStep) : std::vector<Viewport>();
+        nextGuess = 0;
+
+        FrameInfo info;
+        std::vector<WorkerStats> stats;
+        const int* counts = options.frameCache ? cache.find(view, maxIterations) : nullptr;
+        if (counts) {
+            info.source = FrameSource::Cached;
+            info.cacheHits = cache.getHits();
+            info.cacheDiskHits = cache.getDiskHits();
+            info.cacheMisses = cache.getMisses();
+            info.cacheFrames = cache.getFrameCount();
+        } else if ((counts = prefetch.find(view, maxIterations))) {
+            info.source = FrameSource::Prefetched;
+        }
+        if (counts) {
+            // Later pans shift it like any frame
+            frame.adopt(view, renderer, maxIterations, counts);
+            frameView = view;
+            frameComplete = true;
+            if (options.frameCache && info.source == FrameSource::Prefetched)
+                cache.store(view, maxIterations, frame.data());
+            info.precision = renderer.getPrecision();
+            info.complete = true;
+            info.renderMs = elapsedMs();
+            colorAll(frame.data(), 1);
+            publish(frame.data(), info);
+            return;
+        }
+
+        // Pans only iterate the newly exposed strips
+        frameComplete = false;
+        frame.begin(view, renderer, maxIterations, scheduler.getTileSize());
+        info.precision = renderer.getPrecision();
+        while (frame.hasPendingPass()) {
+            int passStep = frame.getPassStep();
+            IterationFrame::TileDoneFn colorPassTile;
+            if (!frame.isPanning()) {
+                colorPassTile = [this, passStep](const Tile& tile) { colorTile(tile, frame.data(), passStep); };
+            }
+            frame.submitPass(scheduler, &cancelRender, colorPassTile);
+            if (!frame.finishPass(scheduler, stats, &cancelRender))
+                return;
+            if (!colorPassTile)
+                colorAll(frame.data(), 1);
+            info.step = frame.getStep();
+            info.complete = !frame.hasPendingPass();
+            info.renderedPixels = frame.getRenderedPixels();
+            info.renderMs = elapsedMs();
+            info.passStats.assign(1, stats);
+            if (info.complete) {
+                frameView = view;
+                frameComplete = true;
+                if (options.frameCache)
+                    cache.store(view, maxIterations, frame.data());
+            }
+            publish(frame.data(), info);
+        }
+    }
+
+    // Renders the next likely view into the prefetch ring, unless the frame
+    // cache already has it. A pan guess starts from the complete frame, if
+    // there is one, so only its exposed strip is iterated. One that is
+    // cancelled is tried again. Deep views are left out: their reference
+    // orbit cannot be cancelled, so a request would wait for it.
+    void guess() {
+        const Viewport& next = guesses[nextGuess++];
+        std::vector<WorkerStats> stats;
+        if (options.frameCache && cache.contains(next, maxIterations))
+            return;
+        if (ViewportRenderer::precisionFor(next) != Precision::Arbitrary && !prefetch.find(next, maxIterations)) {
+            bool pan = frameComplete && next.sameGrid(frameView);
+            if (!prefetch.render(next, maxIterations, pan ? &frameView : nullptr, pan ? frame.data() : nullptr, scheduler, stats, &cancelGuess))
+                nextGuess--;
+        }
+    }
+
+    // New colors are picked up between passes too
+    bool takePalette() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!paletteRequested)
+                return false;
+            paletteRequested = false;
+        }
+        palette = *std::atomic_load(&requestedPalette);
+        return true;
+    }
+
+    // Colors a tile of the scheduler grid into the back buffer from counts
+    // sampled every step pixels. Called on the workers.
+    void colorTile(const Tile& tile, const int* counts, int step) {
+        auto start = std::chrono::steady_clock::now();
+        buffers[back].pixels.colorize(tile, counts, width, step, palette);
+        colorNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        long long sum = 0, samples = 0, capped = 0;
+        for (int y = tile.y0; y < tile.y1; y += step) {
+            const int* row = counts + static_cast<size_t>(y) * width;
+            for (int x = tile.x0; x < tile.x1; x += step) {
+                sum += row[x];
+                capped += row[x] >= maxIterations;
+                samples++;
+            }
+        }
+        iterationSum += sum;
+        sampleCount += samples;
+        maxIterationSamples += capped;
+    }
+
+    void colorAll(const int* counts, int step) {
+        resetTotals();
+        scheduler.run(width, height, [this, counts, step](const Tile& tile) { colorTile(tile, counts, step); });
+    }
+
+    void resetTotals() {
+        colorNs.store(0);
+        iterationSum.store(0);
+        sampleCount.store(0);
+        maxIterationSamples.store(0);
+    }
+
+    // Tiles a cancelled pass colored into the back buffer belong to no frame;
+    // they are restored from the latest one when the buffer is handed over
+    void discardColoring() {
+        Buffer& out = buffers[back];
+        std::vector<int> tiles;
+        out.pixels.takeDirty(tiles);
+        for (int i : tiles) {
+            out.stale[i] = 1;
+        }
+        resetTotals();
+    }
+
+    // Hands the back buffer over, with the tiles colored into it since the
+    // last hand-off as the ones that changed in it
+    void publish(const int* counts, FrameInfo info) {
+        if (takePalette())
+            colorAll(counts, info.step);
+        shownCounts = counts;
+        shownInfo = info;
+
+        Buffer& out = buffers[back];
+        std::vector<int> changed;
+        out.pixels.takeDirty(changed);
+        sequence++;
+        for (int i : changed) {
+            for (Buffer& other : buffers) {
+                other.stale[i] = 1;
+            }
+            out.stale[i] = 0;
+            tileVersions[i] = sequence;
+        }
+        for (int i = 0; i < out.pixels.getTileCount(); i++) {
+            if (out.stale[i] && latest >= 0)
+                out.pixels.copyTile(buffers[latest].pixels, i);
+            out.stale[i] = 0;
+        }
+
+        if (backUnseen) {
+            // The UI skipped that frame; its passes and coloring still count
+            info.passStats.insert(info.passStats.begin(), out.info.passStats.begin(), out.info.passStats.end());
+            info.colorMs += out.info.colorMs;
+        }
+        info.colorMs += colorNs.load() / 1e6 / scheduler.getThreadCount();
+        info.sequence = sequence;
+        info.tileVersions = tileVersions;
+        info.iterations = iterationSum.load();
+        info.pixels = sampleCount.load();
+        info.maxIterationPixels = maxIterationSamples.load();
+        resetTotals();
+        out.info = std::move(info);
+
+        latest = back;
+        int previous = ready.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & ~FRESH;
+        backUnseen = (previous & FRESH) != 0;
+    }
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+// Work-stealing tile scheduler.
+//
+// The frame is cut into small tiles which are dealt round-robin into one deque
+// per worker. A worker pops tiles from the back of its own deque and, when that
+// runs dry, steals from the front of the other workers' deques. Tiles that
+// cross the set interior are far more expensive than exterior ones, so this
+// keeps every core busy until the whole frame is done instead of waiting on
+// the slowest band.
+//
+// The workers are started once, pinned to a core each (from firstCore on, so
+// two schedulers can split the machine, or not at all with UNPINNED), and
+// sleep between frames. A frame is handed to them with submit() and collected
+// with wait(), so a redraw costs a condition variable wakeup instead of
+// spawning threads.
+//
+// cancel() drops the tiles of the current frame that have not started yet.
+// Tiles already being rendered finish, or return early if their TileFn polls
+// isCancelled().
+
+struct Tile {
+    int x0, y0;
+    int x1, y1; // exclusive
+};
+
+struct WorkerStats {
+    double busyMs = 0;
+    double idleMs = 0;
+    double wakeUs = 0; // Time from submit() until the worker started on the frame
+    int tiles = 0;
+    int stolen = 0;
+};
+
+class TileScheduler {
+public:
+    using TileFn = std::function<void(const Tile&)>;
+
+    // firstCore for a process that does not own the cores it runs on: the
+    // threads are left to the OS
+    static const unsigned UNPINNED = ~0u;
+
+    explicit TileScheduler(unsigned threadCount = std::thread::hardware_concurrency(), int tileSize = 32, unsigned firstCore = 0)
+        : threadCount(std::max(1u, threadCount)), tileSize(tileSize), stats(this->threadCount) {
+        unsigned cores = std::thread::hardware_concurrency();
+        for (unsigned i = 0; i < this->threadCount; i++) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for (unsigned i = 0; i < this->threadCount; i++) {
+            workers.emplace_back(&TileScheduler::workerThread, this, i);
+            if (firstCore != UNPINNED && firstCore + this->threadCount <= cores) {
+                pinToCore(workers.back(), firstCore + i);
+            }
+        }
+    }
+
+    ~TileScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        frameReady.notify_all();
+        for (auto& t : workers) {
+            t.join();
+        }
+    }
+
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler& operator=(const TileScheduler&) = delete;
+
+    unsigned getThreadCount() const { return threadCount; }
+    int getTileSize() const { return tileSize; }
+
+    std::vector<Tile> makeTiles(int width, int height) const {
+        std::vector<Tile> tiles;
+        for (int y = 0; y < height; y += tileSize) {
+            for (int x = 0; x < width; x += tileSize) {
+                tiles.push_back({x, y, std::min(x + tileSize, width), std::min(y + tileSize, height)});
+            }
+        }
+        return tiles;
+    }
+
+    // Hands a frame to the workers and returns immediately. Only one frame is
+    // in flight at a time, so this waits for the previous one first.
+    void submit(const std::vector<Tile>& tiles, TileFn renderTile) {
+        wait();
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+            WorkerQueue& queue = *queues[i % threadCount];
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            queue.tiles.push_back(tiles[i]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cancelled.store(false);
+            currentFn = std::move(renderTile);
+            std::fill(stats.begin(), stats.end(), WorkerStats());
+            submitTime = std::chrono::steady_clock::now();
+            runningWorkers = threadCount;
+            frameId++;
+        }
+        frameReady.notify_all();
+    }
+
+    // Blocks until the submitted frame is done. Returns busy/idle time per worker.
+    std::vector<WorkerStats> wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        frameDone.wait(lock, [&]() { return runningWorkers == 0; });
+
+        double wallMs = std::chrono::duration<double, std::milli>(finishTime - submitTime).count();
+        for (auto& s : stats) {
+            s.idleMs = std::max(0.0, wallMs - s.busyMs);
+        }
+        return stats;
+    }
+
+    // True once the submitted frame is finished, without blocking
+    bool isDone() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return runningWorkers == 0;
+    }
+
+    // Abandons the submitted frame; wait() still has to be called
+    void cancel() {
+        cancelled.store(true);
+        for (auto& queue : queues) {
+            std::lock_guard<std::mutex> lock(queue->mtx);
+            queue->tiles.clear();
+        }
+    }
+
+    bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+    // Renders a width x height frame by calling renderTile once per tile and
+    // blocks until every tile is done.
+    std::vector<WorkerStats> run(int width, int height, const TileFn& renderTile) {
+        return run(makeTiles(width, height), renderTile);
+    }
+
+    std::vector<WorkerStats> run(const std::vector<Tile>& tiles, const TileFn& renderTile) {
+        submit(tiles, renderTile);
+        return wait();
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mtx;
+        std::deque<Tile> tiles;
+    };
+
+    unsigned threadCount;
+    int tileSize;
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mtx;
+    std::condition_variable frameReady;
+    std::condition_variable frameDone;
+    TileFn currentFn;
+    std::vector<WorkerStats> stats;
+    std::chrono::steady_clock::time_point submitTime;
+    std::chrono::steady_clock::time_point finishTime;
+    unsigned long long frameId = 0;
+    unsigned runningWorkers = 0;
+    bool stopping = false;
+    std::atomic<bool> cancelled{false};
+
+    static void pinToCore(std::thread& thread, unsigned core) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpus);
+#else
+        (void)thread;
+        (void)core;
+#endif
+    }
+
+    static bool popLocal(WorkerQueue& queue, Tile& tile) {
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        if (queue.tiles.empty())
+            return false;
+        tile = queue.tiles.back();
+        queue.tiles.pop_back();
+        return true;
+    }
+
+    static bool steal(WorkerQueue& queue, Tile& tile) {
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        if (queue.tiles.empty())
+            return false;
+        tile = queue.tiles.front();
+        queue.tiles.pop_front();
+        return true;
+    }
+
+    void workerThread(unsigned self) {
+        unsigned long long seenFrame = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                frameReady.wait(lock, [&]() { return stopping || frameId != seenFrame; });
+                if (stopping)
+                    return;
+                seenFrame = frameId;
+            }
+
+            // currentFn and stats[self] are only written by submit(), which
+            // cannot run again until every worker has checked out below
+            WorkerStats& myStats = stats[self];
+            myStats.wakeUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - submitTime).count();
+            renderTiles(self, myStats);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            if (--runningWorkers == 0) {
+                finishTime = std::chrono::steady_clock::now();
+                frameDone.notify_all();
+            }
+        }
+    }
+
+    void renderTiles(unsigned self, WorkerStats& myStats) {
+        size_t count = queues.size();
+
+        while (true) {
+            Tile tile;
+            bool found = popLocal(*queues[self], tile);
+            if (!found) {
+                for (size_t i = 1; i < count && !found; i++) {
+                    found = steal(*queues[(self + i) % count], tile);
+                }
+                if (!found) {
+                    // Everything left is already being rendered by other workers
+                    break;
+                }
+                myStats.stolen++;
+            }
+
+            auto tileStart = std::chrono::steady_clock::now();
+            currentFn(tile);
+            myStats.busyMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count();
+            myStats.tiles++;
+        }
+    }
+};
+
+inline void printWorkerStats(const std::vector<WorkerStats>& stats, std::ostream& out = std::cout) {
+    double busyTotal = 0, busyMax = 0, wakeMax = 0;
+    for (size_t i = 0; i < stats.size(); i++) {
+        out << "  worker " << i << ": busy " << stats[i].busyMs << " ms, idle " << stats[i].idleMs
+            << " ms, " << stats[i].tiles << " tiles (" << stats[i].stolen << " stolen)" << std::endl;
+        busyTotal += stats[i].busyMs;
+        busyMax = std::max(busyMax, stats[i].busyMs);
+        wakeMax = std::max(wakeMax, stats[i].wakeUs);
+    }
+    if (busyMax > 0) {
+        out << "  balance: " << (busyTotal / stats.size()) / busyMax * 100.0 << "%" << std::endl;
+    }
+    out << "  dispatch: " << wakeMax << " us" << std::endl;
+}